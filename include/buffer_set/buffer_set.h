@@ -16,6 +16,7 @@
 #if !defined(BUFFER_SET_H)
 #define BUFFER_SET_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -23,6 +24,104 @@
 extern "C" {
 #endif
 
+/**
+ * Type used for node indices, set size and capacity.
+ *
+ * By default tree nodes reference each other with 16-bit indices,
+ * so a set can hold at most 65,534 values. Defining BUFFER_SET_WIDE_INDEX
+ * (for the library and for every translation unit including this header)
+ * switches to 32-bit indices, which raises the limit to 4,294,967,294 values
+ * at the cost of a larger node header. The CMake project builds both
+ * variants: `buffer_set` and `buffer_set32`.
+ *
+ * The functions of the wide variant are exported with the buffer_set32_
+ * prefix, so code compiled with one index width does not link against
+ * the library built with the other one.
+ */
+#if defined(BUFFER_SET_WIDE_INDEX)
+typedef uint32_t buffer_set_size_t;
+#else
+typedef uint16_t buffer_set_size_t;
+#endif
+
+#if defined(BUFFER_SET_WIDE_INDEX)
+#define buffer_set_begin                    buffer_set32_begin
+#define buffer_set_build_sorted             buffer_set32_build_sorted
+#define buffer_set_clear                    buffer_set32_clear
+#define buffer_set_create                   buffer_set32_create
+#define buffer_set_create_ex                buffer_set32_create_ex
+#define buffer_set_cursor_first             buffer_set32_cursor_first
+#define buffer_set_cursor_next              buffer_set32_cursor_next
+#define buffer_set_destroy                  buffer_set32_destroy
+#define buffer_set_difference               buffer_set32_difference
+#define buffer_set_emplace                  buffer_set32_emplace
+#define buffer_set_end                      buffer_set32_end
+#define buffer_set_erase                    buffer_set32_erase
+#define buffer_set_erase_at                 buffer_set32_erase_at
+#define buffer_set_erase_by_key             buffer_set32_erase_by_key
+#define buffer_set_erase_if                 buffer_set32_erase_if
+#define buffer_set_erase_range              buffer_set32_erase_range
+#define buffer_set_find                     buffer_set32_find
+#define buffer_set_find_by_key              buffer_set32_find_by_key
+#define buffer_set_find_many                buffer_set32_find_many
+#define buffer_set_freeze                   buffer_set32_freeze
+#define buffer_set_frozen_destroy           buffer_set32_frozen_destroy
+#define buffer_set_frozen_get               buffer_set32_frozen_get
+#define buffer_set_frozen_get_size          buffer_set32_frozen_get_size
+#define buffer_set_frozen_lower_bound       buffer_set32_frozen_lower_bound
+#define buffer_set_get                      buffer_set32_get
+#define buffer_set_get_aggregate            buffer_set32_get_aggregate
+#define buffer_set_get_at                   buffer_set32_get_at
+#define buffer_set_get_by_key               buffer_set32_get_by_key
+#define buffer_set_get_capacity             buffer_set32_get_capacity
+#define buffer_set_get_size                 buffer_set32_get_size
+#define buffer_set_insert                   buffer_set32_insert
+#define buffer_set_insert_many              buffer_set32_insert_many
+#define buffer_set_int_index_create         buffer_set32_int_index_create
+#define buffer_set_int_index_destroy        buffer_set32_int_index_destroy
+#define buffer_set_int_index_get            buffer_set32_int_index_get
+#define buffer_set_intersect                buffer_set32_intersect
+#define buffer_set_iterator_left            buffer_set32_iterator_left
+#define buffer_set_iterator_next            buffer_set32_iterator_next
+#define buffer_set_iterator_prev            buffer_set32_iterator_prev
+#define buffer_set_iterator_right           buffer_set32_iterator_right
+#define buffer_set_join                     buffer_set32_join
+#define buffer_set_last                     buffer_set32_last
+#define buffer_set_lower_bound              buffer_set32_lower_bound
+#define buffer_set_optimize_layout          buffer_set32_optimize_layout
+#define buffer_set_print_debug              buffer_set32_print_debug
+#define buffer_set_rank                     buffer_set32_rank
+#define buffer_set_rbegin                   buffer_set32_rbegin
+#define buffer_set_reader_get               buffer_set32_reader_get
+#define buffer_set_reader_register          buffer_set32_reader_register
+#define buffer_set_reader_unregister        buffer_set32_reader_unregister
+#define buffer_set_root                     buffer_set32_root
+#define buffer_set_select                   buffer_set32_select
+#define buffer_set_sharded_create           buffer_set32_sharded_create
+#define buffer_set_sharded_destroy          buffer_set32_sharded_destroy
+#define buffer_set_sharded_erase            buffer_set32_sharded_erase
+#define buffer_set_sharded_get              buffer_set32_sharded_get
+#define buffer_set_sharded_get_size         buffer_set32_sharded_get_size
+#define buffer_set_sharded_insert           buffer_set32_sharded_insert
+#define buffer_set_sharded_iterator_create  buffer_set32_sharded_iterator_create
+#define buffer_set_sharded_iterator_destroy buffer_set32_sharded_iterator_destroy
+#define buffer_set_sharded_iterator_next    buffer_set32_sharded_iterator_next
+#define buffer_set_shrink                   buffer_set32_shrink
+#define buffer_set_snapshot                 buffer_set32_snapshot
+#define buffer_set_snapshot_get_set         buffer_set32_snapshot_get_set
+#define buffer_set_snapshot_release         buffer_set32_snapshot_release
+#define buffer_set_snapshot_retain          buffer_set32_snapshot_retain
+#define buffer_set_split                    buffer_set32_split
+#define buffer_set_union                    buffer_set32_union
+#define buffer_set_update_aggregate         buffer_set32_update_aggregate
+#define buffer_set_upper_bound              buffer_set32_upper_bound
+#define buffer_set_upsert                   buffer_set32_upsert
+#define buffer_set_verify                   buffer_set32_verify
+#define buffer_set_visit_range              buffer_set32_visit_range
+#define buffer_set_write_begin              buffer_set32_write_begin
+#define buffer_set_write_end                buffer_set32_write_end
+#endif
+
 typedef struct buffer_set_s buffer_set_t;
 typedef struct buffer_set_iterator_s buffer_set_iterator_t;
 
@@ -44,14 +143,120 @@ typedef struct buffer_set_iterator_s buffer_set_iterator_t;
  */
 buffer_set_t * buffer_set_create(
     size_t value_size,
-    uint16_t initial_capacity,
+    buffer_set_size_t initial_capacity,
     int (*compar)(const void * v1, const void * v2, void * thunk),
     void (*move)(void * dst, void * src, void * thunk),
     void * thunk
 );
 
-uint16_t buffer_set_get_size(buffer_set_t * buffer_set);
-uint16_t buffer_set_get_capacity(buffer_set_t * buffer_set);
+/**
+ * Store the tree links and the values in two separate parallel arrays
+ * inside the buffer instead of storing each value next to its links.
+ * A tree descent then touches only the compact link array and the values
+ * of the visited nodes, which reduces cache misses for large values.
+ * Accessing a value through an iterator costs an additional division.
+ */
+#define BUFFER_SET_SPLIT_VALUES 0x0001
+
+/**
+ * Keep the size of the subtree in each node, so the position of a value
+ * in the set (buffer_set_rank()) and the value at a position
+ * (buffer_set_select()) are found in O(log n).
+ * Each node takes a few more bytes and insert and erase
+ * update the sizes along the path to the root.
+ */
+#define BUFFER_SET_ORDER_STATISTICS 0x0002
+
+/**
+ * Let other threads look up values while a single writer thread modifies
+ * the set, see buffer_set_reader_get().
+ * The writer wraps its modifications into buffer_set_write_begin() and
+ * buffer_set_write_end(), which make a sequence counter odd and even again,
+ * a reader walks the tree optimistically and retries if the counter
+ * changed meanwhile. Buffers replaced on growth, shrink and rebuilds are
+ * not released until no reader can access them anymore (epoch based
+ * reclamation), so the buffer is never reallocated in place in this mode.
+ */
+#define BUFFER_SET_CONCURRENT_READS 0x0004
+
+/**
+ * Memory allocator used by the set for its header and its buffer.
+ * Every function gets the ctx pointer as the last argument.
+ *
+ * alloc   Allocates size bytes aligned at least to the pointer size,
+ *         returns NULL on failure.
+ * realloc Resizes the block keeping its content like the realloc(),
+ *         returns NULL on failure leaving the block untouched.
+ *         Can be NULL, the set uses alloc, memcpy and free then.
+ * free    Releases a block previously returned by alloc or realloc,
+ *         size is the size the block was requested with.
+ */
+typedef struct buffer_set_allocator_s
+{
+    void * (*alloc)(size_t size, void * ctx);
+    void * (*realloc)(void * ptr, size_t old_size, size_t new_size, void * ctx);
+    void (*free)(void * ptr, size_t size, void * ctx);
+    void * ctx;
+}
+buffer_set_allocator_t;
+
+/**
+ * Buffer set creation options for buffer_set_create_ex().
+ * The structure should be zero initialized before setting the fields,
+ * so fields added in later versions get their default values.
+ */
+typedef struct buffer_set_options_s
+{
+    size_t value_size;
+    buffer_set_size_t initial_capacity;
+    int (*compar)(const void * v1, const void * v2, void * thunk);
+    void (*move)(void * dst, void * src, void * thunk);
+    void * thunk;
+    unsigned int flags;  /* combination of BUFFER_SET_* flags */
+    /* allocator to use instead of malloc()/realloc()/free(),
+     * copied into the set, can be NULL */
+    const buffer_set_allocator_t * allocator;
+    /* Capacity growth policy, used when the buffer is full.
+     * If grow is set, it returns the new capacity for the current one
+     * (called with the thunk). Otherwise if growth_step is not 0
+     * the capacity is increased by growth_step, else the capacity is
+     * multiplied by growth_factor percent (should be greater than 100,
+     * 150 if 0). The new capacity is limited to the index range. */
+    unsigned int growth_factor;
+    buffer_set_size_t growth_step;
+    buffer_set_size_t (*grow)(buffer_set_size_t capacity, void * thunk);
+    /* Subtree aggregate, see buffer_set_get_aggregate().
+     * aggregate_size bytes are kept in each node, aggregate() computes
+     * the aggregate of a subtree from the value of its root node and
+     * the aggregates of its left and right subtrees (NULL if empty).
+     * Both should be set or both left zero. */
+    size_t aggregate_size;
+    void (*aggregate)(void * aggregate, const void * value, const void * left, const void * right, void * thunk);
+    /* Hash function for the hash index, optional.
+     * If set, the set keeps an open addressing hash index of its nodes
+     * in the same buffer, so buffer_set_get(), buffer_set_find() and
+     * buffer_set_erase() find values in O(1) instead of walking the tree,
+     * at the cost of updating the index on insert and erase and rebuilding it
+     * when the buffer changes. Values equal by compar should have equal hashes. */
+    size_t (*hash)(const void * value, void * thunk);
+    /* Maximum number of registered reader threads
+     * for BUFFER_SET_CONCURRENT_READS, 64 if 0. */
+    unsigned int max_readers;
+}
+buffer_set_options_t;
+
+/**
+ * Creates a new buffer set with the given options,
+ * see buffer_set_create() for the common parameters.
+ *
+ * @return
+ * A pointer to the newly created buffer set, or NULL with errno set
+ * to ENOMEM if memory allocation fails, or to EINVAL if the options are invalid.
+ */
+buffer_set_t * buffer_set_create_ex(const buffer_set_options_t * options);
+
+buffer_set_size_t buffer_set_get_size(buffer_set_t * buffer_set);
+buffer_set_size_t buffer_set_get_capacity(buffer_set_t * buffer_set);
 
 /**
  * Buffer set supports iteration over all items using an iterator.
@@ -66,6 +271,12 @@ uint16_t buffer_set_get_capacity(buffer_set_t * buffer_set);
  *       it = buffer_set_iterator_next(buffer_set, it);
  *   }
  * @endcode
+ *
+ * Iterators are bidirectional, the set can be iterated in the descending
+ * order starting from buffer_set_rbegin() with buffer_set_iterator_prev(),
+ * which returns the end iterator after the smallest value.
+ * buffer_set_iterator_prev() for the end iterator returns the iterator
+ * of the largest value.
  */
 
 buffer_set_iterator_t * buffer_set_begin(buffer_set_t * buffer_set);
@@ -76,6 +287,74 @@ buffer_set_iterator_t * buffer_set_iterator_next(
     buffer_set_iterator_t * it
 );
 
+buffer_set_iterator_t * buffer_set_rbegin(buffer_set_t * buffer_set);
+
+buffer_set_iterator_t * buffer_set_iterator_prev(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+);
+
+/**
+ * Get the largest value of the set in O(log n).
+ *
+ * @return
+ * A pointer to the largest value, or NULL if the set is empty.
+ */
+void * buffer_set_last(buffer_set_t * buffer_set);
+
+/**
+ * Maximum height of the tree, an AVL tree of 2^32 nodes is not higher than 46.
+ */
+#define BUFFER_SET_CURSOR_DEPTH 48
+
+/**
+ * Cursor for the in-order traversal of the set.
+ * Unlike an iterator, the cursor keeps the path of nodes not visited yet
+ * on an explicit stack, so the next value is found without climbing
+ * the parent links, in O(1) amortized time.
+ * The set must not be modified while the cursor is in use.
+ * The structure is used by the cursor functions only.
+ *
+ * Example:
+ * @code
+ *   buffer_set_cursor_t cursor;
+ *   for (void * value = buffer_set_cursor_first(buffer_set, &cursor);
+ *        value != NULL;
+ *        value = buffer_set_cursor_next(buffer_set, &cursor))
+ *   {
+ *       ...
+ *   }
+ * @endcode
+ */
+typedef struct buffer_set_cursor_s
+{
+    unsigned int depth;
+    buffer_set_size_t stack[BUFFER_SET_CURSOR_DEPTH];
+}
+buffer_set_cursor_t;
+
+/**
+ * Positions the cursor at the smallest value of the set.
+ *
+ * @return
+ * A pointer to the smallest value, or NULL if the set is empty.
+ */
+void * buffer_set_cursor_first(
+    buffer_set_t * buffer_set,
+    buffer_set_cursor_t * cursor
+);
+
+/**
+ * Advances the cursor to the next value of the set.
+ *
+ * @return
+ * A pointer to the next value, or NULL if the end of the set is reached.
+ */
+void * buffer_set_cursor_next(
+    buffer_set_t * buffer_set,
+    buffer_set_cursor_t * cursor
+);
+
 void * buffer_set_get(
     buffer_set_t * buffer_set,
     const void * value
@@ -86,6 +365,181 @@ buffer_set_iterator_t * buffer_set_find(
     const void * value
 );
 
+/**
+ * Heterogeneous lookup: search the set by a key instead of a value,
+ * so the caller does not need to build a complete value to search for.
+ *
+ * key_compar compares the key with a value of the set and should be
+ * consistent with the set compar function: negative if the key is ordered
+ * before the value, zero if the value has the key, positive otherwise.
+ * It receives the thunk of the set. The tree is always walked,
+ * the hash index (if any) can not be used for keys.
+ */
+void * buffer_set_get_by_key(
+    buffer_set_t * buffer_set,
+    const void * key,
+    int (*key_compar)(const void * key, const void * value, void * thunk)
+);
+
+buffer_set_iterator_t * buffer_set_find_by_key(
+    buffer_set_t * buffer_set,
+    const void * key,
+    int (*key_compar)(const void * key, const void * value, void * thunk)
+);
+
+/**
+ * Get the number of values in the set less than the given value,
+ * which is the position of the value if it is in the set.
+ * O(log n) for a set created with BUFFER_SET_ORDER_STATISTICS,
+ * O(n) otherwise.
+ */
+buffer_set_size_t buffer_set_rank(
+    buffer_set_t * buffer_set,
+    const void * value
+);
+
+/**
+ * Get the value at the given position in the ascending order
+ * (0 is the smallest value).
+ * O(log n) for a set created with BUFFER_SET_ORDER_STATISTICS,
+ * O(n) otherwise.
+ *
+ * @return
+ * A pointer to the value, or NULL if the position is not less than
+ * the size of the set.
+ */
+void * buffer_set_select(
+    buffer_set_t * buffer_set,
+    buffer_set_size_t position
+);
+
+/**
+ * Subtree aggregates.
+ *
+ * A set created with the aggregate function keeps an aggregate of every
+ * subtree in its root node (a sum of quantities, a maximum timestamp etc).
+ * The library calls the function whenever the children of a node change
+ * (insert, erase, rotations), so the aggregates are always up to date.
+ * Since the aggregate of a new node is calculated from its value,
+ * buffer_set_insert() copies the given value into the set in this mode.
+ * Range aggregate queries are answered in O(log n) by walking the tree
+ * from buffer_set_root() with buffer_set_iterator_left() and
+ * buffer_set_iterator_right(), which return the end iterator for a
+ * missing child.
+ *
+ * Example, sum of values less than x:
+ * @code
+ *   int sum = 0;
+ *   buffer_set_iterator_t * it = buffer_set_root(buffer_set);
+ *   while (it != buffer_set_end(buffer_set))
+ *   {
+ *       const int value = *(int*) buffer_set_get_at(buffer_set, it);
+ *       buffer_set_iterator_t * left = buffer_set_iterator_left(buffer_set, it);
+ *       if (value < x)
+ *       {
+ *           if (left != buffer_set_end(buffer_set))
+ *               sum += *(const int*) buffer_set_get_aggregate(buffer_set, left);
+ *           sum += value;
+ *           it = buffer_set_iterator_right(buffer_set, it);
+ *       }
+ *       else
+ *           it = left;
+ *   }
+ * @endcode
+ */
+
+buffer_set_iterator_t * buffer_set_root(buffer_set_t * buffer_set);
+
+buffer_set_iterator_t * buffer_set_iterator_left(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+);
+
+buffer_set_iterator_t * buffer_set_iterator_right(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+);
+
+/**
+ * Get the aggregate of the subtree rooted at the node the iterator points to.
+ */
+const void * buffer_set_get_aggregate(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+);
+
+/**
+ * Recalculate the aggregates from the node the iterator points to up to
+ * the root, should be called after the part of the value the aggregate
+ * depends on was modified in place.
+ */
+void buffer_set_update_aggregate(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+);
+
+/**
+ * Find the first value of the set not less than the given value.
+ * Together with buffer_set_upper_bound() it gives the equal range
+ * [lower_bound, upper_bound), which contains at most one value.
+ *
+ * @return
+ * An iterator pointing to the found value, or the end iterator
+ * if all values of the set are less than the given value.
+ */
+buffer_set_iterator_t * buffer_set_lower_bound(
+    buffer_set_t * buffer_set,
+    const void * value
+);
+
+/**
+ * Find the first value of the set greater than the given value.
+ *
+ * @return
+ * An iterator pointing to the found value, or the end iterator
+ * if no value of the set is greater than the given value.
+ */
+buffer_set_iterator_t * buffer_set_upper_bound(
+    buffer_set_t * buffer_set,
+    const void * value
+);
+
+/**
+ * Call the callback for every value of the set in the range [lo, hi)
+ * in the ascending order, in O(log n + k) time.
+ * NULL lo or hi means the range is not limited from that side.
+ * The set must not be modified by the callback.
+ *
+ * @param callback Called with the value and the arg, a non zero return
+ *                 value stops the visit.
+ * @return
+ * 0 if all values of the range were visited, or the non zero value
+ * returned by the callback.
+ */
+int buffer_set_visit_range(
+    buffer_set_t * buffer_set,
+    const void * lo,
+    const void * hi,
+    int (*callback)(void * value, void * arg),
+    void * arg
+);
+
+/**
+ * Looks up count values from the array at once.
+ *
+ * The tree descents for several values are interleaved and the next node
+ * of each descent is prefetched, so the memory latency of one lookup
+ * overlaps with the work on the others.
+ * The iterator for values[i] is stored to result[i],
+ * buffer_set_end() if the value is not in the set.
+ */
+void buffer_set_find_many(
+    buffer_set_t * buffer_set,
+    const void * values,
+    size_t count,
+    buffer_set_iterator_t ** result
+);
+
 void * buffer_set_get_at(
     buffer_set_t * buffer_set,
     buffer_set_iterator_t * it
@@ -113,6 +567,8 @@ void * buffer_set_get_at(
  *        *((int *)ptr) = value;
  *    }
  *
+ * A set with the aggregate function copies the value into the new node itself.
+ *
  * The address of the value inside the buffer is always aligned to the size of a pointer.
  */
 void * buffer_set_insert(
@@ -121,6 +577,64 @@ void * buffer_set_insert(
     int * inserted
 );
 
+/**
+ * Find-or-insert with the value constructed in place.
+ *
+ * Searches the set for the key (a value holding at least the fields
+ * the compar function looks at). If it is not found, a new node is
+ * allocated and init is called with the uninitialized value of the node,
+ * the key and ctx to construct the value, before the node is linked
+ * into the tree. The constructed value should be equal to the key
+ * by compar.
+ *
+ * @return
+ * A pointer to the existing or the new value in the set, or NULL with errno
+ * set to ENOMEM if the buffer could not be grown (init is not called then).
+ */
+void * buffer_set_emplace(
+    buffer_set_t * buffer_set,
+    const void * key,
+    void (*init)(void * value, const void * key, void * ctx),
+    void * ctx
+);
+
+/**
+ * Inserts a bytewise copy of the value if an equal value is not in the set,
+ * otherwise calls merge with the value in the set, the given value and ctx.
+ * merge can update the value in the set, but should keep it equal
+ * by compar. Aggregates of the set are updated after the merge.
+ *
+ * @return
+ * A pointer to the value in the set, or NULL with errno set to ENOMEM
+ * if the buffer could not be grown.
+ */
+void * buffer_set_upsert(
+    buffer_set_t * buffer_set,
+    const void * value,
+    void (*merge)(void * value, const void * other, void * ctx),
+    void * ctx
+);
+
+/**
+ * Inserts count values from the array into the set.
+ *
+ * Unlike buffer_set_insert(), new values are copied into the set bytewise,
+ * so the array should contain complete values. The values already present
+ * in the set are looked up in batches like in buffer_set_find_many().
+ * If inserted is not NULL, inserted[i] is set to 1 if values[i] was added
+ * to the set, or to 0 otherwise.
+ *
+ * @return
+ * 0 on success, or -1 if an error occurred (see buffer_set_insert()).
+ * Values processed before the error remain in the set.
+ */
+int buffer_set_insert_many(
+    buffer_set_t * buffer_set,
+    const void * values,
+    size_t count,
+    int * inserted
+);
+
 /**
  * Erase the value from the set.
  *
@@ -134,6 +648,55 @@ void * buffer_set_erase(
     const void * value
 );
 
+/**
+ * Erase the value with the given key from the set,
+ * see buffer_set_get_by_key().
+ *
+ * @return
+ * A pointer to the erased value like buffer_set_erase().
+ */
+void * buffer_set_erase_by_key(
+    buffer_set_t * buffer_set,
+    const void * key,
+    int (*key_compar)(const void * key, const void * value, void * thunk)
+);
+
+/**
+ * Erase all values in the range [lo, hi) from the set,
+ * NULL lo or hi means the range is not limited from that side.
+ *
+ * A few values are erased one by one in O(log n + k log n). If the range
+ * holds a noticeable part of the set, the remaining nodes are linked
+ * into a new balanced tree in O(n) instead of rebalancing the tree
+ * after every erased node.
+ *
+ * @return
+ * The number of erased values. Erased values can be accessed until
+ * a subsequent insertion operation reuses the nodes.
+ * 0 with errno set to ENOMEM if the buffer shared with a snapshot
+ * could not be copied.
+ */
+buffer_set_size_t buffer_set_erase_range(
+    buffer_set_t * buffer_set,
+    const void * lo,
+    const void * hi
+);
+
+/**
+ * Erase all values the predicate returns a non zero value for,
+ * the predicate is called once for every value in ascending order
+ * and must not modify the set. The remaining nodes are linked into
+ * a new balanced tree in O(n).
+ *
+ * @return
+ * The number of erased values.
+ */
+buffer_set_size_t buffer_set_erase_if(
+    buffer_set_t * buffer_set,
+    int (*pred)(const void * value, void * ctx),
+    void * ctx
+);
+
 /**
  * Erase the value at the position pointed to by the iterator from the set.
  *
@@ -158,17 +721,414 @@ int buffer_set_verify(
     FILE * file
 );
 
+/**
+ * Snapshot, an immutable version of the set sharing the buffer with it.
+ *
+ * Taking a snapshot does not copy anything, the buffer becomes shared
+ * and is copied by the next modification of the set (copy on write),
+ * so the writer pays one buffer copy per snapshot, and repeated snapshots
+ * of an unchanged set return the same snapshot. The snapshot is reference
+ * counted and can be passed to other threads, it is searched and iterated
+ * with the regular read functions on the set returned by
+ * buffer_set_snapshot_get_set() without any synchronization with the writer.
+ */
+typedef struct buffer_set_snapshot_s buffer_set_snapshot_t;
+
+/**
+ * Take a snapshot of the set. Values are copied bytewise when the buffer
+ * is copied, so sets with a move function are not supported, neither are
+ * sets created with BUFFER_SET_CONCURRENT_READS.
+ *
+ * @return
+ * A pointer to the snapshot with one reference for the caller, or NULL with
+ * errno set to EINVAL if the set does not support snapshots,
+ * or to ENOMEM if memory allocation fails.
+ */
+buffer_set_snapshot_t * buffer_set_snapshot(buffer_set_t * buffer_set);
+
+/**
+ * @return
+ * A read only set with the content of the snapshot, valid while the snapshot
+ * is referenced. Only the functions not modifying the set can be called with it.
+ */
+buffer_set_t * buffer_set_snapshot_get_set(buffer_set_snapshot_t * snapshot);
+
+/**
+ * Add a reference to the snapshot, can be called from any thread.
+ */
+void buffer_set_snapshot_retain(buffer_set_snapshot_t * snapshot);
+
+/**
+ * Drop a reference to the snapshot, the last one releases the snapshot
+ * (and its buffer if the set does not share it anymore),
+ * can be called from any thread.
+ */
+void buffer_set_snapshot_release(buffer_set_snapshot_t * snapshot);
+
+/**
+ * Start a modification of a set created with BUFFER_SET_CONCURRENT_READS.
+ * All modifications of the set, including filling the value returned by
+ * buffer_set_insert(), should be done between buffer_set_write_begin()
+ * and buffer_set_write_end() by a single writer thread. Calls can be nested,
+ * readers see the set as it was before the outermost begin or after
+ * the outermost end.
+ *
+ * For any set, values modified in place through pointers obtained from
+ * the set while a snapshot of it exists should be modified after
+ * buffer_set_write_begin(), which copies the buffer shared with
+ * the snapshot, and the pointers should be obtained after it.
+ *
+ * @return
+ * 0 on success, or -1 with errno set to ENOMEM if the buffer shared
+ * with a snapshot could not be copied, the section is not started then.
+ */
+int buffer_set_write_begin(buffer_set_t * buffer_set);
+
+/**
+ * End a modification started by buffer_set_write_begin(). The outermost
+ * end releases the buffers replaced meanwhile or earlier which no reader
+ * can access anymore.
+ */
+void buffer_set_write_end(buffer_set_t * buffer_set);
+
+/**
+ * Register a reader thread of a set created with BUFFER_SET_CONCURRENT_READS.
+ *
+ * @return
+ * The reader identifier to pass to buffer_set_reader_get(), or -1 with errno
+ * set to EINVAL if the set was created without the flag, or to EAGAIN
+ * if the maximum number of readers are registered.
+ */
+int buffer_set_reader_register(buffer_set_t * buffer_set);
+
+void buffer_set_reader_unregister(buffer_set_t * buffer_set, int reader);
+
+/**
+ * Look up the value from a reader thread concurrently with the writer.
+ *
+ * The tree is walked without locks and the walk is retried if the writer
+ * modified the set meanwhile, so the compar function can be called with
+ * a partially written value and should not crash on any content of
+ * the value (should not follow pointers stored in values, for example).
+ * Values can not be accessed in place, the found value is copied out.
+ * Every reader thread uses its own reader identifier.
+ *
+ * @param out Receives a copy of the found value.
+ * @return
+ * 1 if the value was found, 0 otherwise.
+ */
+int buffer_set_reader_get(
+    buffer_set_t * buffer_set,
+    int reader,
+    const void * value,
+    void * out
+);
+
 /**
  * Shrink the buffer capacity of the set if it is underutilized.
  *
- * If the number of elements in the set is less than one quarter of the
- * current buffer capacity, the capacity is reduced by half.
+ * While the number of elements in the set is less than one quarter of the
+ * buffer capacity, the capacity is reduced by half.
+ *
+ * If the set has no move function, the nodes located above the new capacity
+ * are moved to free nodes below it and the buffer is truncated in place
+ * with the realloc function of the allocator, so no second buffer is allocated.
+ * Otherwise the tree is moved to a newly allocated smaller buffer
+ * with the move function.
  */
 void buffer_set_shrink(buffer_set_t * buffer_set);
 
+/**
+ * Replace the content of the set with count values from the array.
+ *
+ * The values are expected to be sorted in strictly ascending order
+ * according to the compar function. They are copied bytewise into
+ * consecutive nodes which are then linked into a perfectly balanced tree,
+ * so the whole set is built in O(n) without rebalancing.
+ * The buffer is grown if needed, values previously stored in the set are discarded.
+ *
+ * @return
+ * 0 on success, or -1 with errno set to EINVAL if the values are not sorted,
+ * or to ENOMEM if the buffer could not be allocated.
+ * On failure the set is left unchanged.
+ */
+int buffer_set_build_sorted(
+    buffer_set_t * buffer_set,
+    const void * values,
+    size_t count
+);
+
+/**
+ * Set operations, merge the in-order traversals of both sets
+ * and build the resulting set as a balanced tree in O(n + m).
+ *
+ * Both sets should have the same compar function and value size.
+ * The result is a new set created with the options of the first set,
+ * values are copied into it bytewise. Its capacity is enough for
+ * the largest possible result, use buffer_set_shrink() to release
+ * the unused part.
+ *
+ * @return
+ * A pointer to the new set, or NULL with errno set to EINVAL if the sets
+ * are not compatible, or to ENOMEM if memory allocation fails.
+ */
+buffer_set_t * buffer_set_union(buffer_set_t * a, buffer_set_t * b);
+buffer_set_t * buffer_set_intersect(buffer_set_t * a, buffer_set_t * b);
+buffer_set_t * buffer_set_difference(buffer_set_t * a, buffer_set_t * b);
+
+/**
+ * Split the set at the key, the values not less than the key are moved
+ * into a new set hi created with the options of the set, the set keeps
+ * the values less than the key. The tree is split in place by joining
+ * the subtrees cut off along the search path, O(log^2 n), then the m moved
+ * values are relocated into the buffer of hi (with the move function
+ * if the set has one) and linked into a balanced tree in O(m), as each set
+ * has its own buffer. Splitting off a small upper part of a large set
+ * is cheap, like joining a small set b with buffer_set_join().
+ *
+ * @return
+ * 0 on success, or -1 with errno set to ENOMEM if memory allocation fails,
+ * the set is left unchanged then.
+ */
+int buffer_set_split(
+    buffer_set_t * buffer_set,
+    const void * key,
+    buffer_set_t ** hi
+);
+
+/**
+ * Join the set b to the set a, all values of b should be greater than
+ * the values of a. Values of b are copied into free nodes of a bytewise
+ * and linked into a balanced tree in O(m), which is then joined with
+ * the tree of a in O(log n). The set b is left unchanged, unless the sets
+ * have a move function: the values are relocated with it then
+ * and b is left empty.
+ *
+ * @return
+ * 0 on success, or -1 with errno set to EINVAL if the sets have different
+ * compar, move functions or value sizes or the values are not ordered,
+ * or to ENOMEM if the buffer could not be grown. On failure a is unchanged.
+ */
+int buffer_set_join(buffer_set_t * a, buffer_set_t * b);
+
+/**
+ * Reorder the nodes of the set in the breadth first order of the tree.
+ *
+ * Nodes are taken from the buffer in the order of allocation,
+ * so after a series of inserts and erases the nodes visited by a descent
+ * are scattered over the buffer. After the reordering the root is the first
+ * node followed by the nodes of the next levels, so the top levels of the tree
+ * share cache lines. Intended to be called once after the bulk loading
+ * of a set mostly used for lookups, calling it again does not change the layout
+ * unless the set was modified. Iterators and value pointers are invalidated.
+ *
+ * @return
+ * 0 on success, or -1 with errno set to ENOMEM if the new buffer
+ * could not be allocated, the set is left unchanged then.
+ */
+int buffer_set_optimize_layout(buffer_set_t * buffer_set);
+
+/**
+ * Erases all values of the set, the capacity is kept.
+ */
 void buffer_set_clear(buffer_set_t * buffer_set);
+
 void buffer_set_destroy(buffer_set_t * buffer_set);
 
+/**
+ * Frozen set, an immutable compact copy of the set for lookups.
+ *
+ * Values are stored in one array in the Eytzinger (breadth first) order
+ * of a complete binary search tree without any links, so the array takes
+ * less memory than the set and a descent is a sequence of index
+ * calculations. The search selects the next position without a branch
+ * on the comparison result and prefetches the nodes four levels below,
+ * so the memory latency of the next levels overlaps with the comparisons.
+ * The frozen set uses the compar function, the thunk and the allocator
+ * of the set it was created from, and does not depend on the set otherwise.
+ */
+typedef struct buffer_set_frozen_s buffer_set_frozen_t;
+
+/**
+ * Create a frozen copy of the set, values are copied bytewise.
+ *
+ * @return
+ * A pointer to the frozen set, or NULL with errno set to ENOMEM
+ * if memory allocation fails.
+ */
+buffer_set_frozen_t * buffer_set_freeze(buffer_set_t * buffer_set);
+
+buffer_set_size_t buffer_set_frozen_get_size(const buffer_set_frozen_t * frozen);
+
+/**
+ * @return
+ * A pointer to the value equal to the given one, or NULL if not found.
+ */
+const void * buffer_set_frozen_get(
+    const buffer_set_frozen_t * frozen,
+    const void * value
+);
+
+/**
+ * @return
+ * A pointer to the first value not less than the given one,
+ * or NULL if all values are less than the given one.
+ */
+const void * buffer_set_frozen_lower_bound(
+    const buffer_set_frozen_t * frozen,
+    const void * value
+);
+
+void buffer_set_frozen_destroy(buffer_set_frozen_t * frozen);
+
+/**
+ * Integer key index, a frozen copy of the set for sets ordered by
+ * an integer key, searched with SIMD instructions.
+ *
+ * Keys are stored in a static B-tree with an implicit layout (S-tree):
+ * each block holds 16 32-bit or 8 64-bit keys in one cache line, and
+ * the children of a block are found by an index calculation. A block is
+ * searched with a few vector comparisons (AVX2, SSE4.2/SSE2 on x86,
+ * selected at runtime, or a scalar loop otherwise), so every cache line
+ * loaded on the descent narrows the search by a factor of 17 or 9
+ * instead of 2. Values are copied bytewise next to the keys.
+ *
+ * The key is an integer of the key type located at the key offset inside
+ * each value, the set compar function should order values by this key.
+ */
+#define BUFFER_SET_KEY_INT32  1
+#define BUFFER_SET_KEY_UINT32 2
+#define BUFFER_SET_KEY_UINT64 3
+
+typedef struct buffer_set_int_index_s buffer_set_int_index_t;
+
+/**
+ * Create an integer key index of the set.
+ *
+ * @return
+ * A pointer to the index, or NULL with errno set to EINVAL if the key type
+ * is unknown or the key does not fit into the value, or to ENOMEM
+ * if memory allocation fails.
+ */
+buffer_set_int_index_t * buffer_set_int_index_create(
+    buffer_set_t * buffer_set,
+    int key_type,
+    size_t key_offset
+);
+
+/**
+ * @param key Pointer to the searched key of the index key type.
+ * @return
+ * A pointer to the value with the given key, or NULL if not found.
+ */
+const void * buffer_set_int_index_get(
+    const buffer_set_int_index_t * index,
+    const void * key
+);
+
+void buffer_set_int_index_destroy(buffer_set_int_index_t * index);
+
+/**
+ * Sharded set, a set partitioned by the value hash across a number of
+ * buffer sets (shards), each one protected with its own lock.
+ *
+ * Threads inserting, searching and erasing values in different shards
+ * do not contend with each other, and the total number of values is not
+ * limited by the index range of one set. Values are copied bytewise into
+ * and out of the shards, so the functions never return pointers into a
+ * shard which could be modified by another thread. The merged iterator
+ * walks all values in ascending order over the snapshots of the shards.
+ */
+typedef struct buffer_set_sharded_s buffer_set_sharded_t;
+typedef struct buffer_set_sharded_iterator_s buffer_set_sharded_iterator_t;
+
+/**
+ * Create a sharded set, each shard is created with the given options.
+ * The shard of a value is selected with the given hash function, or with
+ * the hash function of the options if NULL. Values equal by compar should
+ * have equal hashes.
+ *
+ * @return
+ * A pointer to the sharded set, or NULL with errno set to EINVAL if the
+ * number of shards is 0, no hash function is given, or the options have
+ * a move function or BUFFER_SET_CONCURRENT_READS, or to ENOMEM if memory
+ * allocation fails.
+ */
+buffer_set_sharded_t * buffer_set_sharded_create(
+    const buffer_set_options_t * options,
+    unsigned int shards,
+    size_t (*hash)(const void * value, void * thunk)
+);
+
+/**
+ * @return
+ * The total number of values, the shards are counted one by one,
+ * so the result is not exact while other threads modify the set.
+ */
+size_t buffer_set_sharded_get_size(buffer_set_sharded_t * sharded);
+
+/**
+ * Insert a copy of the value if an equal value is not in the set yet.
+ *
+ * @return
+ * 1 if the value was inserted, 0 if an equal value is already in the set,
+ * or -1 if the shard could not be grown.
+ */
+int buffer_set_sharded_insert(
+    buffer_set_sharded_t * sharded,
+    const void * value
+);
+
+/**
+ * Copy the value equal to the given one into out (can be NULL).
+ *
+ * @return
+ * 1 if the value was found, 0 otherwise.
+ */
+int buffer_set_sharded_get(
+    buffer_set_sharded_t * sharded,
+    const void * value,
+    void * out
+);
+
+/**
+ * Erase the value equal to the given one, the erased value is copied
+ * into out (can be NULL).
+ *
+ * @return
+ * 1 if the value was erased, 0 if not found.
+ */
+int buffer_set_sharded_erase(
+    buffer_set_sharded_t * sharded,
+    const void * value,
+    void * out
+);
+
+/**
+ * Create an iterator over all values of the sharded set in ascending order.
+ * Each shard is locked only to take its snapshot, so the iterator sees
+ * every shard as it was at that moment, and writers copy the buffer
+ * of a shard on the next modification while the iterator exists.
+ * The iterator should be used by one thread at a time.
+ *
+ * @return
+ * A pointer to the iterator, or NULL with errno set to ENOMEM
+ * if memory allocation fails, or as set by buffer_set_snapshot()
+ * if a snapshot of a shard could not be taken.
+ */
+buffer_set_sharded_iterator_t * buffer_set_sharded_iterator_create(buffer_set_sharded_t * sharded);
+
+/**
+ * @return
+ * A pointer to the next value, valid until the iterator is destroyed,
+ * or NULL if all values were visited.
+ */
+const void * buffer_set_sharded_iterator_next(buffer_set_sharded_iterator_t * it);
+
+void buffer_set_sharded_iterator_destroy(buffer_set_sharded_iterator_t * it);
+
+void buffer_set_sharded_destroy(buffer_set_sharded_t * sharded);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,210 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#if !defined(BUFFER_SET_HPP)
+#define BUFFER_SET_HPP
+
+#include <buffer_set/buffer_set.h>
+#include "buffer_set_internal.h"
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace js_labs {
+
+/**
+ * C++ wrapper over the buffer set. Lookups walk the tree with the Compare
+ * inlined, the tree maintenance (node allocation, rebalancing, erase)
+ * is done by the library. The wrapper reads the internal layout of the set,
+ * so the private header buffer_set_internal.h from the library sources
+ * should be on the include path and the code built together with the library.
+ *
+ * Compare is a strict weak ordering like for std::set.
+ * Values are relocated when the buffer grows: trivially copyable types
+ * are copied bytewise, other types are move constructed into the new
+ * location and destroyed in the old one.
+ */
+template <typename T, typename Compare = std::less<T> >
+class buffer_set
+{
+    static_assert(alignof(T) <= alignof(void*), "values are aligned to the size of a pointer");
+
+public:
+    class iterator
+    {
+    public:
+        iterator(buffer_set_t * buffer_set, buffer_set_iterator_t * it): m_buffer_set(buffer_set), m_it(it) {}
+        T & operator*() const { return *static_cast<T*>(buffer_set_get_at(m_buffer_set, m_it)); }
+        T * operator->() const { return static_cast<T*>(buffer_set_get_at(m_buffer_set, m_it)); }
+        iterator & operator++() { m_it = buffer_set_iterator_next(m_buffer_set, m_it); return *this; }
+        iterator & operator--() { m_it = buffer_set_iterator_prev(m_buffer_set, m_it); return *this; }
+        bool operator==(const iterator & other) const { return (m_it == other.m_it); }
+        bool operator!=(const iterator & other) const { return (m_it != other.m_it); }
+
+    private:
+        buffer_set_t * m_buffer_set;
+        buffer_set_iterator_t * m_it;
+    };
+
+    explicit buffer_set(buffer_set_size_t initial_capacity = 0, const Compare & compare = Compare()):
+        m_compare(compare),
+        m_buffer_set(buffer_set_create(
+            sizeof(T),
+            initial_capacity,
+            &_compar,
+            std::is_trivially_copyable<T>::value ? nullptr : &_move,
+            this
+        ))
+    {
+        if (m_buffer_set == nullptr)
+            throw std::bad_alloc();
+    }
+
+    ~buffer_set()
+    {
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            for (T & value : *this)
+                value.~T();
+        }
+        buffer_set_destroy(m_buffer_set);
+    }
+
+    buffer_set(const buffer_set &) = delete;
+    buffer_set & operator=(const buffer_set &) = delete;
+
+    buffer_set_size_t size() const { return buffer_set_get_size(m_buffer_set); }
+    bool empty() const { return (size() == 0); }
+
+    iterator begin() { return iterator(m_buffer_set, buffer_set_begin(m_buffer_set)); }
+    iterator end() { return iterator(m_buffer_set, buffer_set_end(m_buffer_set)); }
+
+    T * find(const T & value)
+    {
+        if (m_buffer_set->hash_index)
+            return static_cast<T*>(buffer_set_get(m_buffer_set, &value));
+        const buffer_set_size_t idx = _find(value);
+        return idx ? _value(idx) : nullptr;
+    }
+
+    /**
+     * Inserts a copy of the value if an equivalent value is not in the set yet.
+     * @return
+     * A pointer to the value in the set and a flag whether the insertion took place.
+     * Throws std::bad_alloc if the set could not be grown.
+     */
+    std::pair<T*, bool> insert(const T & value)
+    {
+        buffer_set_size_t parent_idx = 0;
+        buffer_set_size_t idx = m_buffer_set->root;
+        int cmp = 0;
+        while (idx != 0)
+        {
+            T * node_value = _value(idx);
+            cmp = _cmp(value, *node_value);
+            if (cmp == 0)
+                return std::pair<T*, bool>(node_value, false);
+            parent_idx = idx;
+            idx = _child(idx, cmp);
+        }
+        void * ptr = buffer_set_insert_leaf(m_buffer_set, &value, parent_idx, cmp);
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        return std::pair<T*, bool>(new (ptr) T(value), true);
+    }
+
+    bool erase(const T & value)
+    {
+        T * ptr;
+        if (m_buffer_set->hash_index)
+            ptr = static_cast<T*>(buffer_set_erase(m_buffer_set, &value));
+        else
+        {
+            const buffer_set_size_t idx = _find(value);
+            ptr = idx ? static_cast<T*>(buffer_set_erase_at(
+                m_buffer_set, reinterpret_cast<buffer_set_iterator_t*>(_buffer_set_get_node(m_buffer_set, idx)))) : nullptr;
+        }
+        if (ptr == nullptr)
+            return false;
+        ptr->~T();
+        return true;
+    }
+
+    buffer_set_t * get() { return m_buffer_set; }
+
+private:
+    int _cmp(const T & value1, const T & value2) const
+    {
+        if (m_compare(value1, value2))
+            return -1;
+        else if (m_compare(value2, value1))
+            return 1;
+        else
+            return 0;
+    }
+
+    T * _value(buffer_set_size_t idx) const
+    {
+        return static_cast<T*>(_buffer_set_get_value(m_buffer_set, idx));
+    }
+
+    buffer_set_size_t _child(buffer_set_size_t idx, int cmp) const
+    {
+        const struct buffer_set_node_s * node = _buffer_set_get_node(m_buffer_set, idx);
+        return (cmp < 0) ? node->left : node->right;
+    }
+
+    buffer_set_size_t _find(const T & value) const
+    {
+        // the layout is kept in locals and the child is selected without
+        // a branch, the compiler can not do it with the structure fields
+        const char * nodes = static_cast<const char*>(m_buffer_set->buffer);
+        const char * values = static_cast<const char*>(m_buffer_set->values);
+        const size_t node_size = m_buffer_set->node_size;
+        const size_t value_stride = m_buffer_set->value_stride;
+        buffer_set_size_t idx = m_buffer_set->root;
+        while (idx != 0)
+        {
+            const int cmp = _cmp(value, *reinterpret_cast<const T*>(values + (value_stride * idx)));
+            if (cmp == 0)
+                break;
+            const struct buffer_set_node_s * node = reinterpret_cast<const struct buffer_set_node_s*>(nodes + (node_size * idx));
+            idx = (cmp < 0) ? node->left : node->right;
+        }
+        return idx;
+    }
+
+    static int _compar(const void * v1, const void * v2, void * thunk)
+    {
+        const buffer_set & self = *static_cast<const buffer_set*>(thunk);
+        return self._cmp(*static_cast<const T*>(v1), *static_cast<const T*>(v2));
+    }
+
+    static void _move(void * dst, void * src, void * thunk)
+    {
+        (void) thunk;
+        T * src_value = static_cast<T*>(src);
+        new (dst) T(std::move(*src_value));
+        src_value->~T();
+    }
+
+    Compare m_compare;
+    buffer_set_t * m_buffer_set;
+};
+
+} // namespace js_labs
+
+#endif /* BUFFER_SET_HPP */
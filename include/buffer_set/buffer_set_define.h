@@ -0,0 +1,174 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#if !defined(BUFFER_SET_DEFINE_H)
+#define BUFFER_SET_DEFINE_H
+
+#include <buffer_set/buffer_set.h>
+
+/**
+ * Type specialized sets of values of the given type
+ * with the comparison inlined into the tree descent.
+ *
+ * The generic functions call the comparison function through a pointer
+ * at every tree level, which prevents the compiler from inlining it.
+ * BUFFER_SET_DEFINE() generates functions walking the tree with
+ * the comparison expression inlined, while the tree maintenance
+ * (node allocation, rebalancing, erase) is still done by the library.
+ * The descent reads the internal layout of the set, so BUFFER_SET_DEFINE()
+ * should be expanded in one source file which includes the private
+ * header buffer_set_internal.h from the library sources (the src directory
+ * on the include path) and is built together with the library.
+ * Other source files use the functions after BUFFER_SET_DECLARE().
+ *
+ * Sets with a hash index are looked up through the index by the library.
+ * For BUFFER_SET_CONCURRENT_READS the functions are called by the writer,
+ * insert and erase inside a write section. A set created with name_create()
+ * is a regular buffer_set_t, all other buffer_set_*() functions can be used
+ * with it as well.
+ *
+ * @param name     Prefix of the generated functions.
+ * @param type     Type of the stored values.
+ * @param cmp_expr Expression comparing values pointed to by `a` and `b`
+ *                 (both `const type *`), evaluating to a negative value,
+ *                 zero or a positive value like the regular compar function.
+ *
+ * Example:
+ * @code
+ *   // int_set.c
+ *   #include <buffer_set/buffer_set_define.h>
+ *   #include "buffer_set_internal.h"
+ *   BUFFER_SET_DEFINE(int_set, int, (*a > *b) - (*a < *b))
+ *
+ *   // other files
+ *   BUFFER_SET_DECLARE(int_set, int)
+ *   ...
+ *   buffer_set_t * buffer_set = int_set_create(16);
+ *   int value = 42;
+ *   int inserted;
+ *   int_set_insert(buffer_set, &value, &inserted);
+ *   int * ptr = int_set_get(buffer_set, &value);
+ * @endcode
+ *
+ * Generated functions:
+ *   int name_compar(const void * v1, const void * v2, void * thunk);
+ *   buffer_set_t * name_create(buffer_set_size_t initial_capacity);
+ *   buffer_set_iterator_t * name_find(buffer_set_t *, const type * value);
+ *   type * name_get(buffer_set_t *, const type * value);
+ *   type * name_insert(buffer_set_t *, const type * value, int * inserted);
+ *   type * name_erase(buffer_set_t *, const type * value);
+ *
+ * Unlike buffer_set_insert(), name_insert() copies the value into the set
+ * if a new node was allocated.
+ */
+#define BUFFER_SET_DECLARE(name, type) \
+    int name##_compar(const void * v1, const void * v2, void * thunk); \
+    buffer_set_t * name##_create(buffer_set_size_t initial_capacity); \
+    buffer_set_iterator_t * name##_find(buffer_set_t * buffer_set, const type * value); \
+    type * name##_get(buffer_set_t * buffer_set, const type * value); \
+    type * name##_insert(buffer_set_t * buffer_set, const type * value, int * inserted); \
+    type * name##_erase(buffer_set_t * buffer_set, const type * value);
+
+#define BUFFER_SET_DEFINE(name, type, cmp_expr) \
+    BUFFER_SET_DECLARE(name, type) \
+    \
+    static inline int name##_cmp(const type * a, const type * b) \
+    { \
+        return (cmp_expr); \
+    } \
+    \
+    int name##_compar(const void * v1, const void * v2, void * thunk) \
+    { \
+        (void) thunk; \
+        return name##_cmp((const type*) v1, (const type*) v2); \
+    } \
+    \
+    buffer_set_t * name##_create(buffer_set_size_t initial_capacity) \
+    { \
+        return buffer_set_create(sizeof(type), initial_capacity, &name##_compar, NULL, NULL); \
+    } \
+    \
+    static inline buffer_set_size_t name##_find_idx(buffer_set_t * buffer_set, const type * value) \
+    { \
+        /* the layout is kept in locals and the child is selected without */ \
+        /* a branch, the compiler can not do it with the structure fields */ \
+        const char * nodes = (const char*) buffer_set->buffer; \
+        const char * values = (const char*) buffer_set->values; \
+        const size_t node_size = buffer_set->node_size; \
+        const size_t value_stride = buffer_set->value_stride; \
+        buffer_set_size_t idx = buffer_set->root; \
+        while (idx != 0) \
+        { \
+            const int cmp = name##_cmp(value, (const type*) (values + (value_stride * idx))); \
+            if (cmp == 0) \
+                break; \
+            const struct buffer_set_node_s * node = (const struct buffer_set_node_s*) (nodes + (node_size * idx)); \
+            idx = (cmp < 0) ? node->left : node->right; \
+        } \
+        return idx; \
+    } \
+    \
+    buffer_set_iterator_t * name##_find(buffer_set_t * buffer_set, const type * value) \
+    { \
+        if (buffer_set->hash_index) \
+            return buffer_set_find(buffer_set, value); \
+        /* node 0 is the end of the set */ \
+        const buffer_set_size_t idx = name##_find_idx(buffer_set, value); \
+        return (buffer_set_iterator_t*) _buffer_set_get_node(buffer_set, idx); \
+    } \
+    \
+    type * name##_get(buffer_set_t * buffer_set, const type * value) \
+    { \
+        if (buffer_set->hash_index) \
+            return (type*) buffer_set_get(buffer_set, value); \
+        const buffer_set_size_t idx = name##_find_idx(buffer_set, value); \
+        return idx ? (type*) _buffer_set_get_value(buffer_set, idx) : NULL; \
+    } \
+    \
+    type * name##_insert(buffer_set_t * buffer_set, const type * value, int * inserted) \
+    { \
+        buffer_set_size_t parent_idx = 0; \
+        buffer_set_size_t idx = buffer_set->root; \
+        int cmp = 0; \
+        while (idx != 0) \
+        { \
+            type * node_value = (type*) _buffer_set_get_value(buffer_set, idx); \
+            cmp = name##_cmp(value, node_value); \
+            if (cmp == 0) \
+            { \
+                *inserted = 0; \
+                return node_value; \
+            } \
+            parent_idx = idx; \
+            idx = (&_buffer_set_get_node(buffer_set, idx)->left)[cmp > 0]; \
+        } \
+        type * ret = (type*) buffer_set_insert_leaf(buffer_set, value, parent_idx, cmp); \
+        *inserted = (ret != NULL); \
+        if (ret) \
+            *ret = *value; \
+        return ret; \
+    } \
+    \
+    type * name##_erase(buffer_set_t * buffer_set, const type * value) \
+    { \
+        if (buffer_set->hash_index) \
+            return (type*) buffer_set_erase(buffer_set, value); \
+        const buffer_set_size_t idx = name##_find_idx(buffer_set, value); \
+        if (idx == 0) \
+            return NULL; \
+        return (type*) buffer_set_erase_at(buffer_set, (buffer_set_iterator_t*) _buffer_set_get_node(buffer_set, idx)); \
+    }
+
+#endif /* BUFFER_SET_DEFINE_H */
@@ -14,8 +14,10 @@
  */
 
 #include <buffer_set/buffer_set.h>
+#include "buffer_set_internal.h"
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,34 +29,81 @@
 // streamlining index calculations.
 
 #define NULL_IDX (0)
-#define MIN_CAPACITY ((uint16_t)0x0010)
-#define MAX_CAPACITY ((uint16_t)0xFFFF)
-#define CAPACITY_GROWTH_STEP ((uint16_t)0x400)
+#define MIN_CAPACITY ((buffer_set_size_t)0x0010)
+#define MAX_CAPACITY ((buffer_set_size_t)~((buffer_set_size_t)0))
+// Percent of the current capacity the capacity grows to by default
+#define DEFAULT_GROWTH_FACTOR 150
+
+// Number of tree descents interleaved by the batch functions
+#define BATCH_SIZE 8
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(ptr) __builtin_prefetch(ptr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define PREFETCH(ptr) _mm_prefetch((const char*)(ptr), _MM_HINT_T0)
+#else
+#define PREFETCH(ptr) ((void)0)
+#endif
 
-struct node_s
-{
-    uint16_t parent;
-    uint16_t left;
-    uint16_t right;
-    int8_t balance;
-};
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#include <emmintrin.h>
+#endif
+
+#if defined(BUFFER_SET_WIDE_INDEX)
+#define IDX_FMT PRIu32
+#else
+#define IDX_FMT PRIu16
+#endif
 
 struct free_node_s
 {
-    uint16_t next;
+    buffer_set_size_t next;
 };
 
-struct buffer_set_s
+struct buffer_set_frozen_s
 {
-    size_t node_size;
+    size_t value_size;
+    size_t value_stride;
     int (*compar)(const void * v1, const void * v2, void * thunk);
-    void (*move)(void * dst, void * src, void * thunk);
     void * thunk;
-    uint16_t capacity;
-    uint16_t size;
-    uint16_t root;
-    void * buffer;
-    uint16_t free_list;
+    buffer_set_allocator_t allocator;
+    buffer_set_size_t size;
+    // Value at the Eytzinger position k (starting from 1)
+    // is located at (values + k * value_stride).
+    char * values;
+};
+
+// Reader slot, one per cache line, so readers do not share lines
+#define READER_SLOT_SIZE 64
+#define DEFAULT_MAX_READERS 64
+
+struct buffer_set_reader_slot_s
+{
+    // epoch the reader entered, 0 if it is not reading
+    size_t epoch;
+    long used;
+    char padding[READER_SLOT_SIZE - sizeof(size_t) - sizeof(long)];
+};
+
+struct buffer_set_retired_s
+{
+    void * ptr;
+    size_t size;
+    size_t epoch;
+};
+
+// Internal flag of the read only set of a snapshot
+#define SNAPSHOT_VIEW 0x80000000u
+
+struct buffer_set_snapshot_s
+{
+    // copy of the set header at the time of the snapshot, the buffer
+    // is shared with the set until the set is modified
+    struct buffer_set_s set;
+    size_t buffer_size;
+    long refcount;
 };
 
 static inline size_t _round(size_t v)
@@ -64,37 +113,550 @@ static inline size_t _round(size_t v)
     return (v - (v & c));
 }
 
-static inline struct node_s * _get_node(
+// Memory ordering primitives for BUFFER_SET_CONCURRENT_READS.
+// On x86 with MSVC plain loads have the acquire and plain stores the release
+// semantics, only the compiler reordering has to be prevented.
+
+static inline unsigned int _load_acquire_uint(const unsigned int * ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#else
+    const unsigned int v = *((const volatile unsigned int*) ptr);
+    _ReadWriteBarrier();
+    return v;
+#endif
+}
+
+static inline void _store_release_uint(unsigned int * ptr, unsigned int v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(ptr, v, __ATOMIC_RELEASE);
+#else
+    _ReadWriteBarrier();
+    *((volatile unsigned int*) ptr) = v;
+#endif
+}
+
+static inline size_t _load_acquire_size(const size_t * ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#else
+    const size_t v = *((const volatile size_t*) ptr);
+    _ReadWriteBarrier();
+    return v;
+#endif
+}
+
+static inline void _store_release_size(size_t * ptr, size_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(ptr, v, __ATOMIC_RELEASE);
+#else
+    _ReadWriteBarrier();
+    *((volatile size_t*) ptr) = v;
+#endif
+}
+
+static inline void _memory_fence(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#else
+    _mm_mfence();
+#endif
+}
+
+static inline void _cpu_pause(void)
+{
+    // spin-wait hint, lets the other hardware thread of the core run
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_ia32_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#endif
+}
+
+static inline long _atomic_add(long * ptr, long value)
+{
+    // returns the new value
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL);
+#else
+    return (_InterlockedExchangeAdd((volatile long*) ptr, value) + value);
+#endif
+}
+
+static inline int _claim(long * ptr)
+{
+    // changes the value from 0 to 1, returns whether it succeeded
+#if defined(__GNUC__) || defined(__clang__)
+    long expected = 0;
+    return __atomic_compare_exchange_n(ptr, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#else
+    return (_InterlockedCompareExchange((volatile long*) ptr, 1, 0) == 0);
+#endif
+}
+
+static void * _default_alloc(size_t size, void * ctx)
+{
+    (void) ctx;
+    return malloc(size);
+}
+
+static void * _default_realloc(void * ptr, size_t old_size, size_t new_size, void * ctx)
+{
+    (void) old_size;
+    (void) ctx;
+    return realloc(ptr, new_size);
+}
+
+static void _default_free(void * ptr, size_t size, void * ctx)
+{
+    (void) size;
+    (void) ctx;
+    free(ptr);
+}
+
+const buffer_set_allocator_t buffer_set_default_allocator = {
+    &_default_alloc,
+    &_default_realloc,
+    &_default_free,
+    NULL
+};
+
+static inline void * _alloc(struct buffer_set_s * buffer_set, size_t size)
+{
+    return buffer_set->allocator.alloc(size, buffer_set->allocator.ctx);
+}
+
+static void * _realloc(
+    struct buffer_set_s * buffer_set,
+    void * ptr,
+    size_t old_size,
+    size_t new_size
+) {
+    const buffer_set_allocator_t * allocator = &buffer_set->allocator;
+    if (allocator->realloc)
+        return allocator->realloc(ptr, old_size, new_size, allocator->ctx);
+
+    void * new_ptr = allocator->alloc(new_size, allocator->ctx);
+    if (new_ptr)
+    {
+        memcpy(new_ptr, ptr, (old_size < new_size) ? old_size : new_size);
+        allocator->free(ptr, old_size, allocator->ctx);
+    }
+    return new_ptr;
+}
+
+static inline void _free(struct buffer_set_s * buffer_set, void * ptr, size_t size)
+{
+    // the buffer is NULL for a set with zero capacity
+    if (ptr)
+        buffer_set->allocator.free(ptr, size, buffer_set->allocator.ctx);
+}
+
+static inline int _is_writable(struct buffer_set_s * buffer_set)
+{
+    if (buffer_set->flags & SNAPSHOT_VIEW)
+        return 0;
+    return (!(buffer_set->flags & BUFFER_SET_CONCURRENT_READS) || (buffer_set->write_depth > 0));
+}
+
+
+static inline size_t _get_readers_alloc_size(unsigned int max_readers)
+{
+    // slots are aligned to the cache line inside the block
+    return ((max_readers * sizeof(struct buffer_set_reader_slot_s)) + (READER_SLOT_SIZE - 1));
+}
+
+static void _synchronize(struct buffer_set_s * buffer_set)
+{
+    // Waits until the readers which could see the current state leave,
+    // the readers entering later see the state published before.
+    const size_t epoch = (buffer_set->epoch + 1);
+    _store_release_size(&buffer_set->epoch, epoch);
+    _memory_fence();
+    for (unsigned int idx=0; idx<buffer_set->max_readers; idx++)
+    {
+        const size_t * reader_epoch = &buffer_set->readers[idx].epoch;
+        for (;;)
+        {
+            const size_t value = _load_acquire_size(reader_epoch);
+            if ((value == 0) || (value >= epoch))
+                break;
+        }
+    }
+}
+
+static void _free_buffer(struct buffer_set_s * buffer_set, void * ptr, size_t size)
+{
+    // A buffer shared with a snapshot is released with the snapshot.
+    if (buffer_set->snapshot && (ptr == buffer_set->snapshot->set.buffer))
+    {
+        struct buffer_set_snapshot_s * snapshot = buffer_set->snapshot;
+        buffer_set->snapshot = NULL;
+        buffer_set_snapshot_release(snapshot);
+        return;
+    }
+
+    // Readers can still walk a replaced buffer, it is retired with
+    // the current epoch and released when all readers left the epoch.
+    if (!(buffer_set->flags & BUFFER_SET_CONCURRENT_READS) || (ptr == NULL))
+    {
+        _free(buffer_set, ptr, size);
+        return;
+    }
+
+    if (buffer_set->retired_count == buffer_set->retired_capacity)
+    {
+        const size_t retired_capacity = (buffer_set->retired_capacity ? (buffer_set->retired_capacity * 2) : 4);
+        const size_t old_size = (buffer_set->retired_capacity * sizeof(struct buffer_set_retired_s));
+        const size_t new_size = (retired_capacity * sizeof(struct buffer_set_retired_s));
+        struct buffer_set_retired_s * retired = buffer_set->retired
+            ? _realloc(buffer_set, buffer_set->retired, old_size, new_size)
+            : _alloc(buffer_set, new_size);
+        if (retired == NULL)
+        {
+            // no memory to defer the release, wait for the readers instead
+            _synchronize(buffer_set);
+            _free(buffer_set, ptr, size);
+            return;
+        }
+        buffer_set->retired = retired;
+        buffer_set->retired_capacity = retired_capacity;
+    }
+
+    struct buffer_set_retired_s * retired = &buffer_set->retired[buffer_set->retired_count++];
+    retired->ptr = ptr;
+    retired->size = size;
+    retired->epoch = buffer_set->epoch;
+}
+
+static void _reclaim(struct buffer_set_s * buffer_set)
+{
+    // Starts a new epoch and releases the buffers retired before
+    // the oldest epoch a reader is still in.
+    if (buffer_set->retired_count == 0)
+        return;
+
+    size_t min_epoch = (buffer_set->epoch + 1);
+    _store_release_size(&buffer_set->epoch, min_epoch);
+    _memory_fence();
+    for (unsigned int idx=0; idx<buffer_set->max_readers; idx++)
+    {
+        const size_t epoch = _load_acquire_size(&buffer_set->readers[idx].epoch);
+        if ((epoch != 0) && (epoch < min_epoch))
+            min_epoch = epoch;
+    }
+
+    size_t count = 0;
+    for (size_t idx=0; idx<buffer_set->retired_count; idx++)
+    {
+        struct buffer_set_retired_s * retired = &buffer_set->retired[idx];
+        if (retired->epoch < min_epoch)
+            _free(buffer_set, retired->ptr, retired->size);
+        else
+            buffer_set->retired[count++] = *retired;
+    }
+    buffer_set->retired_count = count;
+}
+
+static inline struct buffer_set_node_s * _get_node(
     struct buffer_set_s * buffer_set,
-    uint16_t idx
+    buffer_set_size_t idx
 ) {
     char * ptr = (char*) buffer_set->buffer;
     ptr += (buffer_set->node_size * idx);
-    return (struct node_s*) ptr;
+    return (struct buffer_set_node_s*) ptr;
 }
 
 static inline struct free_node_s * _get_free_node(
     struct buffer_set_s * buffer_set,
-    uint16_t idx
+    buffer_set_size_t idx
 ) {
     char * ptr = (char*) buffer_set->buffer;
     ptr += (buffer_set->node_size * idx);
     return (struct free_node_s*) ptr;
 }
 
-static inline void * _node_get_value(struct node_s * node)
+static inline void * _get_value(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    char * ptr = (char*) buffer_set->values;
+    ptr += (buffer_set->value_stride * idx);
+    return ptr;
+}
+
+static inline buffer_set_size_t _get_node_idx(
+    struct buffer_set_s * buffer_set,
+    const struct buffer_set_node_s * node
+) {
+    const ptrdiff_t offs = (((const char*)node) - ((const char*)buffer_set->buffer));
+    assert((offs % buffer_set->node_size) == 0);
+    return (buffer_set_size_t) (offs / buffer_set->node_size);
+}
+
+static inline buffer_set_size_t * _get_count(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    // number of nodes in the subtree, BUFFER_SET_ORDER_STATISTICS only,
+    // always 0 for the node 0
+    char * ptr = (char*) _get_node(buffer_set, idx);
+    return (buffer_set_size_t*) (ptr + sizeof(struct buffer_set_node_s));
+}
+
+static inline void * _get_aggregate(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    char * ptr = (char*) _get_node(buffer_set, idx);
+    return (ptr + buffer_set->aggregate_offset);
+}
+
+static inline int _is_augmented(struct buffer_set_s * buffer_set)
+{
+    return ((buffer_set->flags & BUFFER_SET_ORDER_STATISTICS) || buffer_set->aggregate);
+}
+
+static inline void _update_node(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    // Recalculates the augmented data of the node from its children.
+    if (buffer_set->flags & BUFFER_SET_ORDER_STATISTICS)
+    {
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+        *_get_count(buffer_set, idx) = (buffer_set_size_t)
+            (1 + *_get_count(buffer_set, node->left) + *_get_count(buffer_set, node->right));
+    }
+    if (buffer_set->aggregate)
+    {
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+        buffer_set->aggregate(
+            _get_aggregate(buffer_set, idx),
+            _get_value(buffer_set, idx),
+            (node->left == NULL_IDX) ? NULL : _get_aggregate(buffer_set, node->left),
+            (node->right == NULL_IDX) ? NULL : _get_aggregate(buffer_set, node->right),
+            buffer_set->thunk
+        );
+    }
+}
+
+static void _update_path(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    // Recalculates the augmented data from the node up to the root.
+    if (_is_augmented(buffer_set))
+    {
+        while (idx != NULL_IDX)
+        {
+            _update_node(buffer_set, idx);
+            idx = _get_node(buffer_set, idx)->parent;
+        }
+    }
+}
+
+static inline size_t _get_hash_size(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t capacity
+) {
+    // Number of the hash index entries, a power of 2 at least twice
+    // as large as the capacity, which keeps the load factor below 0.5.
+    if ((buffer_set->hash == NULL) || (capacity == 0))
+        return 0;
+    size_t size = 1;
+    while (size < ((size_t) capacity * 2))
+        size *= 2;
+    return size;
+}
+
+static inline size_t _get_buffer_size(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t capacity
+) {
+    // each slot occupies (node_size + value_stride) bytes
+    // if values are stored in a separate array, or node_size bytes otherwise
+    size_t slot_size = buffer_set->node_size;
+    if (buffer_set->flags & BUFFER_SET_SPLIT_VALUES)
+        slot_size += buffer_set->value_stride;
+    // the hash index follows the nodes (and the values), its size
+    // is limited by the index range, so the sum does not overflow
+    const size_t hash_size = _get_hash_size(buffer_set, capacity) * sizeof(buffer_set_size_t);
+    if (capacity > ((SIZE_MAX - hash_size) / slot_size))
+        return 0;
+    return (slot_size * capacity) + hash_size;
+}
+
+static inline void * _get_values(
+    struct buffer_set_s * buffer_set,
+    void * buffer,
+    buffer_set_size_t capacity
+) {
+    if (buffer == NULL)
+        return NULL;
+    else if (buffer_set->flags & BUFFER_SET_SPLIT_VALUES)
+        return ((char*)buffer) + (buffer_set->node_size * capacity);
+    else
+        return ((char*)buffer) + buffer_set->header_size;
+}
+
+static inline void _set_buffer(
+    struct buffer_set_s * buffer_set,
+    void * buffer,
+    buffer_set_size_t capacity
+) {
+    buffer_set->buffer = buffer;
+    buffer_set->capacity = capacity;
+    buffer_set->values = _get_values(buffer_set, buffer, capacity);
+    if (buffer && (buffer_set->flags & BUFFER_SET_ORDER_STATISTICS))
+        *_get_count(buffer_set, NULL_IDX) = 0;
+    const size_t hash_size = _get_hash_size(buffer_set, capacity);
+    if (hash_size)
+    {
+        size_t slot_size = buffer_set->node_size;
+        if (buffer_set->flags & BUFFER_SET_SPLIT_VALUES)
+            slot_size += buffer_set->value_stride;
+        buffer_set->hash_index = (buffer_set_size_t*) (((char*)buffer) + (slot_size * capacity));
+        buffer_set->hash_mask = (hash_size - 1);
+    }
+    else
+    {
+        buffer_set->hash_index = NULL;
+        buffer_set->hash_mask = 0;
+    }
+}
+
+static int _unshare(struct buffer_set_s * buffer_set)
+{
+    // Copy on write: the set gets its own copy of the buffer shared
+    // with a snapshot before the buffer is modified.
+    struct buffer_set_snapshot_s * snapshot = buffer_set->snapshot;
+    if (snapshot == NULL)
+        return 0;
+
+    // all other references are released, the buffer is not shared anymore
+    if (_atomic_add(&snapshot->refcount, 0) == 1)
+    {
+        buffer_set->snapshot = NULL;
+        _free(buffer_set, snapshot, sizeof(struct buffer_set_snapshot_s));
+        return 0;
+    }
+
+    if (buffer_set->buffer)
+    {
+        const size_t buffer_size = snapshot->buffer_size;
+        void * buffer = _alloc(buffer_set, buffer_size);
+        if (buffer == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(buffer, buffer_set->buffer, buffer_size);
+        _set_buffer(buffer_set, buffer, buffer_set->capacity);
+    }
+
+    buffer_set->snapshot = NULL;
+    buffer_set_snapshot_release(snapshot);
+    return 0;
+}
+
+static inline size_t _get_hash_pos(
+    struct buffer_set_s * buffer_set,
+    const void * value
+) {
+    return (buffer_set->hash(value, buffer_set->thunk) & buffer_set->hash_mask);
+}
+
+static void _hash_insert(
+    struct buffer_set_s * buffer_set,
+    const void * value,
+    buffer_set_size_t idx
+) {
+    // linear probing, the index always has free entries
+    buffer_set_size_t * hash_index = buffer_set->hash_index;
+    size_t pos = _get_hash_pos(buffer_set, value);
+    while (hash_index[pos] != NULL_IDX)
+        pos = ((pos + 1) & buffer_set->hash_mask);
+    hash_index[pos] = idx;
+}
+
+static void _hash_remove(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    buffer_set_size_t * hash_index = buffer_set->hash_index;
+    const size_t mask = buffer_set->hash_mask;
+    size_t pos = _get_hash_pos(buffer_set, _get_value(buffer_set, idx));
+    while (hash_index[pos] != idx)
+    {
+        assert(hash_index[pos] != NULL_IDX);
+        pos = ((pos + 1) & mask);
+    }
+
+    // Backward shift deletion: the following entries of the cluster
+    // which would become unreachable are moved into the hole.
+    size_t next = pos;
+    for (;;)
+    {
+        next = ((next + 1) & mask);
+        const buffer_set_size_t next_idx = hash_index[next];
+        if (next_idx == NULL_IDX)
+            break;
+        const size_t home = _get_hash_pos(buffer_set, _get_value(buffer_set, next_idx));
+        // the entry stays if its home position is cyclically in (pos, next]
+        const int stays = (pos <= next)
+            ? ((pos < home) && (home <= next))
+            : ((pos < home) || (home <= next));
+        if (!stays)
+        {
+            hash_index[pos] = next_idx;
+            pos = next;
+        }
+    }
+    hash_index[pos] = NULL_IDX;
+}
+
+static void _hash_tree(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+    if (node->left != NULL_IDX)
+        _hash_tree(buffer_set, node->left);
+    if (node->right != NULL_IDX)
+        _hash_tree(buffer_set, node->right);
+    _hash_insert(buffer_set, _get_value(buffer_set, idx), idx);
+}
+
+static void _rehash(struct buffer_set_s * buffer_set)
 {
-    return ((char*)node) + _round(sizeof(struct node_s));
+    // Rebuilds the hash index after the buffer or the node indices changed.
+    if (buffer_set->hash_index)
+    {
+        memset(buffer_set->hash_index, 0, (buffer_set->hash_mask + 1) * sizeof(buffer_set_size_t));
+        if (buffer_set->root != NULL_IDX)
+            _hash_tree(buffer_set, buffer_set->root);
+    }
 }
 
-static uint16_t _make_free_list(
+static buffer_set_size_t _make_free_list(
     void * buffer,
     size_t node_size,
-    uint16_t first_idx,
-    uint16_t count
+    buffer_set_size_t first_idx,
+    buffer_set_size_t count
 ) {
+    if (count == 0)
+        return NULL_IDX;
+
     struct free_node_s * free_node = (struct free_node_s*) (((char*)buffer) + (node_size * first_idx));
-    uint16_t idx = first_idx;
+    buffer_set_size_t idx = first_idx;
     for (;;)
     {
         if (--count == 0)
@@ -113,67 +675,144 @@ static uint16_t _make_free_list(
 
 buffer_set_t * buffer_set_create(
     size_t value_size,
-    uint16_t initial_capacity,
+    buffer_set_size_t initial_capacity,
     int (*compar)(const void * v1, const void * v2, void * thunk),
     void (*move)(void * dst, void * src, void * thunk),
     void * thunk
 ) {
-    struct buffer_set_s * buffer_set = malloc(sizeof(struct buffer_set_s));
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = value_size;
+    options.initial_capacity = initial_capacity;
+    options.compar = compar;
+    options.move = move;
+    options.thunk = thunk;
+    return buffer_set_create_ex(&options);
+}
+
+buffer_set_t * buffer_set_create_ex(const buffer_set_options_t * options)
+{
+    if (((options->growth_factor != 0) && (options->growth_factor <= 100)) ||
+        ((options->aggregate == NULL) != (options->aggregate_size == 0)))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    const buffer_set_allocator_t * allocator = options->allocator
+        ? options->allocator
+        : &buffer_set_default_allocator;
+    struct buffer_set_s * buffer_set = allocator->alloc(sizeof(struct buffer_set_s), allocator->ctx);
     if (buffer_set == NULL)
     {
-        // errno set to ENOMEM by malloc()
+        // a custom allocator does not necessarily set errno
+        errno = ENOMEM;
         return NULL;
     }
 
-    const size_t node_size = _round(sizeof(struct node_s)) + _round(value_size);
+    buffer_set->allocator = *allocator;
+    buffer_set->seq = 0;
+    buffer_set->write_depth = 0;
+    buffer_set->epoch = 1;
+    buffer_set->readers = NULL;
+    buffer_set->readers_alloc = NULL;
+    buffer_set->max_readers = 0;
+    buffer_set->retired = NULL;
+    buffer_set->retired_count = 0;
+    buffer_set->retired_capacity = 0;
+    buffer_set->snapshot = NULL;
+    if (options->flags & BUFFER_SET_CONCURRENT_READS)
+    {
+        const unsigned int max_readers = options->max_readers ? options->max_readers : DEFAULT_MAX_READERS;
+        const size_t readers_alloc_size = _get_readers_alloc_size(max_readers);
+        void * readers_alloc = _alloc(buffer_set, readers_alloc_size);
+        if (readers_alloc == NULL)
+        {
+            allocator->free(buffer_set, sizeof(struct buffer_set_s), allocator->ctx);
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(readers_alloc, 0, readers_alloc_size);
+        uintptr_t readers = (uintptr_t) readers_alloc;
+        readers = ((readers + (READER_SLOT_SIZE - 1)) & ~((uintptr_t) (READER_SLOT_SIZE - 1)));
+        buffer_set->readers = (struct buffer_set_reader_slot_s*) readers;
+        buffer_set->readers_alloc = readers_alloc;
+        buffer_set->max_readers = max_readers;
+    }
+
+    // the subtree size follows the node links in the order statistics mode,
+    // then the aggregate follows aligned to the pointer size
+    size_t header_size = sizeof(struct buffer_set_node_s);
+    if (options->flags & BUFFER_SET_ORDER_STATISTICS)
+        header_size += sizeof(buffer_set_size_t);
+    header_size = _round(header_size);
+    const size_t aggregate_offset = header_size;
+    header_size = _round(header_size + options->aggregate_size);
+    const size_t value_stride = _round(options->value_size);
+    const size_t node_size = (options->flags & BUFFER_SET_SPLIT_VALUES)
+        ? header_size
+        : (header_size + value_stride);
 
     buffer_set->node_size = node_size;
-    buffer_set->compar = compar;
-    buffer_set->move = move;
-    buffer_set->thunk = thunk;
-    buffer_set->capacity = initial_capacity;
+    buffer_set->header_size = header_size;
+    buffer_set->aggregate_offset = aggregate_offset;
+    buffer_set->aggregate = options->aggregate;
+    buffer_set->hash = options->hash;
+    buffer_set->value_size = options->value_size;
+    buffer_set->value_stride = (options->flags & BUFFER_SET_SPLIT_VALUES) ? value_stride : node_size;
+    buffer_set->compar = options->compar;
+    buffer_set->move = options->move;
+    buffer_set->thunk = options->thunk;
+    buffer_set->flags = options->flags;
+    buffer_set->growth_factor = options->growth_factor ? options->growth_factor : DEFAULT_GROWTH_FACTOR;
+    buffer_set->growth_step = options->growth_step;
+    buffer_set->grow = options->grow;
     buffer_set->size = 0;
     buffer_set->root = NULL_IDX;
 
+    const buffer_set_size_t initial_capacity = options->initial_capacity;
     if (initial_capacity > 0)
     {
-        const size_t buffer_size = (node_size * initial_capacity);
-        void * buffer = malloc(buffer_size);
+        const size_t buffer_size = _get_buffer_size(buffer_set, initial_capacity);
+        void * buffer = buffer_size ? _alloc(buffer_set, buffer_size) : NULL;
         if (!buffer)
         {
-            free(buffer_set);
+            _free(buffer_set, buffer_set->readers_alloc, _get_readers_alloc_size(buffer_set->max_readers));
+            allocator->free(buffer_set, sizeof(struct buffer_set_s), allocator->ctx);
+            errno = ENOMEM;
             return NULL;
         }
-        buffer_set->buffer = buffer;
+        _set_buffer(buffer_set, buffer, initial_capacity);
         buffer_set->free_list = _make_free_list(buffer, node_size, 1, initial_capacity - 1);
+        _rehash(buffer_set);
     }
     else
     {
-        buffer_set->buffer = NULL;
+        _set_buffer(buffer_set, NULL, 0);
         buffer_set->free_list = NULL_IDX;
     }
 
     return buffer_set;
 }
 
-uint16_t buffer_set_get_size(buffer_set_t * buffer_set)
+buffer_set_size_t buffer_set_get_size(buffer_set_t * buffer_set)
 {
     return buffer_set->size;
 }
 
-uint16_t buffer_set_get_capacity(buffer_set_t * buffer_set)
+buffer_set_size_t buffer_set_get_capacity(buffer_set_t * buffer_set)
 {
     return buffer_set->capacity;
 }
 
 buffer_set_iterator_t * buffer_set_begin(buffer_set_t * buffer_set)
 {
-    uint16_t idx = buffer_set->root;
+    buffer_set_size_t idx = buffer_set->root;
     if (idx == NULL_IDX)
         return buffer_set->buffer;
     for (;;)
     {
-        struct node_s * node = _get_node(buffer_set, idx);
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
         if (node->left == NULL_IDX)
             return (buffer_set_iterator_t*) node;
         idx = node->left;
@@ -189,7 +828,7 @@ buffer_set_iterator_t * buffer_set_iterator_next(
     buffer_set_t * buffer_set,
     buffer_set_iterator_t * it
 ) {
-    struct node_s * node = (struct node_s*) it;
+    struct buffer_set_node_s * node = (struct buffer_set_node_s*) it;
     if (node->right == NULL_IDX)
     {
         for (;;)
@@ -197,14 +836,13 @@ buffer_set_iterator_t * buffer_set_iterator_next(
             if (node->parent == NULL_IDX)
                 return buffer_set_end(buffer_set);
 
-            const ptrdiff_t offs = (((char*)node) - ((char*)buffer_set->buffer));
-            assert((offs % buffer_set->node_size) == 0);
-            const uint16_t from_idx = (uint16_t) (offs / buffer_set->node_size);
+            // compare the node addresses to avoid calculating the node index
+            struct buffer_set_node_s * from_node = node;
             node = _get_node(buffer_set, node->parent);
-            if (node->left == from_idx)
+            if (_get_node(buffer_set, node->left) == from_node)
                 return (buffer_set_iterator_t*) node;
 
-            assert(node->right == from_idx);
+            assert(_get_node(buffer_set, node->right) == from_node);
         }
     }
     else
@@ -216,81 +854,483 @@ buffer_set_iterator_t * buffer_set_iterator_next(
     }
 }
 
-void * buffer_set_get(
-    buffer_set_t * buffer_set,
-    const void * value
+static buffer_set_size_t _get_last_idx(struct buffer_set_s * buffer_set)
+{
+    buffer_set_size_t idx = buffer_set->root;
+    if (idx != NULL_IDX)
+    {
+        for (;;)
+        {
+            const buffer_set_size_t right = _get_node(buffer_set, idx)->right;
+            if (right == NULL_IDX)
+                break;
+            idx = right;
+        }
+    }
+    return idx;
+}
+
+buffer_set_iterator_t * buffer_set_rbegin(buffer_set_t * buffer_set)
+{
+    // node 0 is the end of the set
+    return (buffer_set_iterator_t*) _get_node(buffer_set, _get_last_idx(buffer_set));
+}
+
+buffer_set_iterator_t * buffer_set_iterator_prev(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
 ) {
-    buffer_set_iterator_t * it = buffer_set_find(buffer_set, value);
     if (it == buffer_set_end(buffer_set))
-        return NULL;
-    return buffer_set_get_at(buffer_set, it);
+        return buffer_set_rbegin(buffer_set);
+
+    struct buffer_set_node_s * node = (struct buffer_set_node_s*) it;
+    if (node->left == NULL_IDX)
+    {
+        for (;;)
+        {
+            if (node->parent == NULL_IDX)
+                return buffer_set_end(buffer_set);
+
+            struct buffer_set_node_s * from_node = node;
+            node = _get_node(buffer_set, node->parent);
+            if (_get_node(buffer_set, node->right) == from_node)
+                return (buffer_set_iterator_t*) node;
+
+            assert(_get_node(buffer_set, node->left) == from_node);
+        }
+    }
+    else
+    {
+        node = _get_node(buffer_set, node->left);
+        while (node->right != NULL_IDX)
+            node = _get_node(buffer_set, node->right);
+        return (buffer_set_iterator_t*) node;
+    }
 }
 
-void * buffer_set_get_at(
+void * buffer_set_last(buffer_set_t * buffer_set)
+{
+    const buffer_set_size_t idx = _get_last_idx(buffer_set);
+    return (idx == NULL_IDX) ? NULL : _get_value(buffer_set, idx);
+}
+
+static inline void _cursor_push_left(
+    struct buffer_set_s * buffer_set,
+    buffer_set_cursor_t * cursor,
+    buffer_set_size_t idx
+) {
+    while (idx != NULL_IDX)
+    {
+        assert(cursor->depth < BUFFER_SET_CURSOR_DEPTH);
+        cursor->stack[cursor->depth++] = idx;
+        idx = _get_node(buffer_set, idx)->left;
+    }
+}
+
+void * buffer_set_cursor_first(
     buffer_set_t * buffer_set,
-    buffer_set_iterator_t * it
+    buffer_set_cursor_t * cursor
 ) {
-    struct node_s * node = (struct node_s*) it;
-    return _node_get_value(node);
+    // The top of the stack is the current node,
+    // nodes below it are the ancestors with values not visited yet.
+    cursor->depth = 0;
+    _cursor_push_left(buffer_set, cursor, buffer_set->root);
+    if (cursor->depth == 0)
+        return NULL;
+    return _get_value(buffer_set, cursor->stack[cursor->depth - 1]);
 }
 
-buffer_set_iterator_t * buffer_set_find(
+void * buffer_set_cursor_next(
     buffer_set_t * buffer_set,
+    buffer_set_cursor_t * cursor
+) {
+    if (cursor->depth == 0)
+        return NULL;
+    const buffer_set_size_t idx = cursor->stack[--cursor->depth];
+    _cursor_push_left(buffer_set, cursor, _get_node(buffer_set, idx)->right);
+    if (cursor->depth == 0)
+        return NULL;
+    return _get_value(buffer_set, cursor->stack[cursor->depth - 1]);
+}
+
+static buffer_set_size_t _hash_find(
+    struct buffer_set_s * buffer_set,
+    const void * value
+) {
+    const buffer_set_size_t * hash_index = buffer_set->hash_index;
+    size_t pos = _get_hash_pos(buffer_set, value);
+    for (;;)
+    {
+        const buffer_set_size_t idx = hash_index[pos];
+        if ((idx == NULL_IDX) ||
+            (buffer_set->compar(value, _get_value(buffer_set, idx), buffer_set->thunk) == 0))
+        {
+            return idx;
+        }
+        pos = ((pos + 1) & buffer_set->hash_mask);
+    }
+}
+
+static buffer_set_size_t _find(
+    struct buffer_set_s * buffer_set,
     const void * value
 ) {
-    uint16_t idx = buffer_set->root;
+    if (buffer_set->hash_index)
+        return _hash_find(buffer_set, value);
+
+    buffer_set_size_t idx = buffer_set->root;
     for (;;)
     {
         if (idx == NULL_IDX)
-            return buffer_set_end(buffer_set);
-        struct node_s * node = _get_node(buffer_set, idx);
-        const int cmp = buffer_set->compar(value, _node_get_value(node), buffer_set->thunk);
+            return NULL_IDX;
+        const int cmp = buffer_set->compar(value, _get_value(buffer_set, idx), buffer_set->thunk);
         if (cmp == 0)
-            return (buffer_set_iterator_t*) node;
+            return idx;
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
         const int side = ((cmp > 0) ? 1 : 0);
         idx = (&node->left)[side];
     }
 }
 
-static inline uint16_t _round_up_power_of_2(uint16_t value)
-{
-    value--;
-    value |= (value >> 1);
-    value |= (value >> 2);
-    value |= (value >> 4);
-    value |= (value >> 8);
-    value++;
-    return value;
+static buffer_set_size_t _find_by_key(
+    struct buffer_set_s * buffer_set,
+    const void * key,
+    int (*key_compar)(const void * key, const void * value, void * thunk)
+) {
+    buffer_set_size_t idx = buffer_set->root;
+    for (;;)
+    {
+        if (idx == NULL_IDX)
+            return NULL_IDX;
+        const int cmp = key_compar(key, _get_value(buffer_set, idx), buffer_set->thunk);
+        if (cmp == 0)
+            return idx;
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+        const int side = ((cmp > 0) ? 1 : 0);
+        idx = (&node->left)[side];
+    }
+}
+
+void * buffer_set_get(
+    buffer_set_t * buffer_set,
+    const void * value
+) {
+    const buffer_set_size_t idx = _find(buffer_set, value);
+    if (idx == NULL_IDX)
+        return NULL;
+    return _get_value(buffer_set, idx);
+}
+
+void * buffer_set_get_at(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+) {
+    struct buffer_set_node_s * node = (struct buffer_set_node_s*) it;
+    if (buffer_set->flags & BUFFER_SET_SPLIT_VALUES)
+        return _get_value(buffer_set, _get_node_idx(buffer_set, node));
+    else
+        return ((char*)node) + buffer_set->header_size;
+}
+
+buffer_set_iterator_t * buffer_set_find(
+    buffer_set_t * buffer_set,
+    const void * value
+) {
+    // node 0 is used as the end iterator
+    const buffer_set_size_t idx = _find(buffer_set, value);
+    return (buffer_set_iterator_t*) _get_node(buffer_set, idx);
+}
+
+void * buffer_set_get_by_key(
+    buffer_set_t * buffer_set,
+    const void * key,
+    int (*key_compar)(const void * key, const void * value, void * thunk)
+) {
+    const buffer_set_size_t idx = _find_by_key(buffer_set, key, key_compar);
+    if (idx == NULL_IDX)
+        return NULL;
+    return _get_value(buffer_set, idx);
+}
+
+buffer_set_iterator_t * buffer_set_find_by_key(
+    buffer_set_t * buffer_set,
+    const void * key,
+    int (*key_compar)(const void * key, const void * value, void * thunk)
+) {
+    const buffer_set_size_t idx = _find_by_key(buffer_set, key, key_compar);
+    return (buffer_set_iterator_t*) _get_node(buffer_set, idx);
+}
+
+buffer_set_size_t buffer_set_rank(
+    buffer_set_t * buffer_set,
+    const void * value
+) {
+    buffer_set_size_t rank = 0;
+    if (buffer_set->flags & BUFFER_SET_ORDER_STATISTICS)
+    {
+        buffer_set_size_t idx = buffer_set->root;
+        while (idx != NULL_IDX)
+        {
+            const int cmp = buffer_set->compar(value, _get_value(buffer_set, idx), buffer_set->thunk);
+            struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+            if (cmp > 0)
+            {
+                rank += (*_get_count(buffer_set, node->left) + 1);
+                idx = node->right;
+            }
+            else if (cmp < 0)
+                idx = node->left;
+            else
+            {
+                rank += *_get_count(buffer_set, node->left);
+                break;
+            }
+        }
+    }
+    else
+    {
+        buffer_set_cursor_t cursor;
+        for (void * node_value = buffer_set_cursor_first(buffer_set, &cursor);
+             node_value && (buffer_set->compar(node_value, value, buffer_set->thunk) < 0);
+             node_value = buffer_set_cursor_next(buffer_set, &cursor))
+        {
+            rank++;
+        }
+    }
+    return rank;
+}
+
+void * buffer_set_select(
+    buffer_set_t * buffer_set,
+    buffer_set_size_t position
+) {
+    if (position >= buffer_set->size)
+        return NULL;
+
+    if (buffer_set->flags & BUFFER_SET_ORDER_STATISTICS)
+    {
+        buffer_set_size_t idx = buffer_set->root;
+        for (;;)
+        {
+            struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+            const buffer_set_size_t left_count = *_get_count(buffer_set, node->left);
+            if (position < left_count)
+                idx = node->left;
+            else if (position == left_count)
+                return _get_value(buffer_set, idx);
+            else
+            {
+                position -= (left_count + 1);
+                idx = node->right;
+            }
+            assert(idx != NULL_IDX);
+        }
+    }
+    else
+    {
+        buffer_set_cursor_t cursor;
+        void * value = buffer_set_cursor_first(buffer_set, &cursor);
+        for (; position > 0; position--)
+            value = buffer_set_cursor_next(buffer_set, &cursor);
+        return value;
+    }
 }
 
-static uint16_t _calculate_new_capacity(uint16_t capacity)
+buffer_set_iterator_t * buffer_set_root(buffer_set_t * buffer_set)
 {
-    // The implemented logic doubles the capacity while it less than 1024 elements,
-    // then increase capacity by 1024 each time.
-    if (capacity < MIN_CAPACITY)
-        return MIN_CAPACITY;
+    return (buffer_set_iterator_t*) _get_node(buffer_set, buffer_set->root);
+}
+
+buffer_set_iterator_t * buffer_set_iterator_left(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+) {
+    struct buffer_set_node_s * node = (struct buffer_set_node_s*) it;
+    return (buffer_set_iterator_t*) _get_node(buffer_set, node->left);
+}
+
+buffer_set_iterator_t * buffer_set_iterator_right(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+) {
+    struct buffer_set_node_s * node = (struct buffer_set_node_s*) it;
+    return (buffer_set_iterator_t*) _get_node(buffer_set, node->right);
+}
+
+const void * buffer_set_get_aggregate(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+) {
+    return ((const char*) it) + buffer_set->aggregate_offset;
+}
+
+void buffer_set_update_aggregate(
+    buffer_set_t * buffer_set,
+    buffer_set_iterator_t * it
+) {
+    const buffer_set_size_t idx = _get_node_idx(buffer_set, (struct buffer_set_node_s*) it);
+    if (_unshare(buffer_set) == 0)
+        _update_path(buffer_set, idx);
+}
+
+static buffer_set_size_t _bound(
+    struct buffer_set_s * buffer_set,
+    const void * value,
+    int upper
+) {
+    // Returns the first node with a value greater than the given one
+    // (or equal to it unless upper), the lowest such node seen on the descent.
+    buffer_set_size_t result = NULL_IDX;
+    buffer_set_size_t idx = buffer_set->root;
+    while (idx != NULL_IDX)
+    {
+        const int cmp = buffer_set->compar(value, _get_value(buffer_set, idx), buffer_set->thunk);
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+        if ((cmp < 0) || ((cmp == 0) && !upper))
+        {
+            result = idx;
+            idx = node->left;
+        }
+        else
+            idx = node->right;
+    }
+    return result;
+}
+
+buffer_set_iterator_t * buffer_set_lower_bound(
+    buffer_set_t * buffer_set,
+    const void * value
+) {
+    const buffer_set_size_t idx = _bound(buffer_set, value, 0);
+    return (buffer_set_iterator_t*) _get_node(buffer_set, idx);
+}
+
+buffer_set_iterator_t * buffer_set_upper_bound(
+    buffer_set_t * buffer_set,
+    const void * value
+) {
+    const buffer_set_size_t idx = _bound(buffer_set, value, 1);
+    return (buffer_set_iterator_t*) _get_node(buffer_set, idx);
+}
+
+int buffer_set_visit_range(
+    buffer_set_t * buffer_set,
+    const void * lo,
+    const void * hi,
+    int (*callback)(void * value, void * arg),
+    void * arg
+) {
+    buffer_set_iterator_t * it = lo ? buffer_set_lower_bound(buffer_set, lo) : buffer_set_begin(buffer_set);
+    buffer_set_iterator_t * it_end = buffer_set_end(buffer_set);
+    while (it != it_end)
+    {
+        void * value = buffer_set_get_at(buffer_set, it);
+        if (hi && (buffer_set->compar(value, hi, buffer_set->thunk) >= 0))
+            break;
+        const int rc = callback(value, arg);
+        if (rc != 0)
+            return rc;
+        it = buffer_set_iterator_next(buffer_set, it);
+    }
+    return 0;
+}
+
+static void _find_batch(
+    struct buffer_set_s * buffer_set,
+    const char * values,
+    size_t count,
+    buffer_set_size_t * result
+) {
+    // Walks up to BATCH_SIZE descents level by level, so the memory accesses
+    // of the different descents overlap instead of stalling on each level.
+    assert(count <= BATCH_SIZE);
+    buffer_set_size_t idx[BATCH_SIZE];
+    size_t active = 0;
+    for (size_t jdx=0; jdx<count; jdx++)
+    {
+        idx[jdx] = buffer_set->root;
+        result[jdx] = NULL_IDX;
+        active += (idx[jdx] != NULL_IDX);
+    }
+
+    const size_t value_size = buffer_set->value_size;
+    const int split_values = (buffer_set->flags & BUFFER_SET_SPLIT_VALUES);
+    while (active > 0)
+    {
+        const char * value = values;
+        for (size_t jdx=0; jdx<count; jdx++, value+=value_size)
+        {
+            const buffer_set_size_t node_idx = idx[jdx];
+            if (node_idx == NULL_IDX)
+                continue;
+
+            const int cmp = buffer_set->compar(value, _get_value(buffer_set, node_idx), buffer_set->thunk);
+            buffer_set_size_t next_idx = NULL_IDX;
+            if (cmp == 0)
+                result[jdx] = node_idx;
+            else
+            {
+                struct buffer_set_node_s * node = _get_node(buffer_set, node_idx);
+                next_idx = (&node->left)[(cmp > 0) ? 1 : 0];
+            }
+
+            idx[jdx] = next_idx;
+            if (next_idx == NULL_IDX)
+                active--;
+            else
+            {
+                PREFETCH(_get_value(buffer_set, next_idx));
+                if (split_values)
+                    PREFETCH(_get_node(buffer_set, next_idx));
+            }
+        }
+    }
+}
 
-    if (capacity <= (CAPACITY_GROWTH_STEP / 2))
+void buffer_set_find_many(
+    buffer_set_t * buffer_set,
+    const void * values,
+    size_t count,
+    buffer_set_iterator_t ** result
+) {
+    const size_t value_size = buffer_set->value_size;
+    buffer_set_size_t idx[BATCH_SIZE];
+    for (size_t first=0; first<count; first+=BATCH_SIZE)
     {
-        uint16_t new_capacity = _round_up_power_of_2(capacity);
-        if (new_capacity != capacity)
-            return new_capacity;
-        new_capacity *= 2;
-        return new_capacity;
+        const size_t batch_size = ((count - first) < BATCH_SIZE) ? (count - first) : BATCH_SIZE;
+        _find_batch(buffer_set, ((const char*)values) + (first * value_size), batch_size, idx);
+        for (size_t jdx=0; jdx<batch_size; jdx++)
+            result[first + jdx] = (buffer_set_iterator_t*) _get_node(buffer_set, idx[jdx]);
     }
+}
+
+static buffer_set_size_t _calculate_new_capacity(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t capacity
+) {
+    // A fixed step makes the amortized insert cost linear in the set size,
+    // while a geometric growth keeps it constant.
+    uint64_t new_capacity;
+    if (buffer_set->grow)
+        new_capacity = buffer_set->grow(capacity, buffer_set->thunk);
+    else if (buffer_set->growth_step)
+        new_capacity = ((uint64_t) capacity + buffer_set->growth_step);
+    else
+        new_capacity = (((uint64_t) capacity * buffer_set->growth_factor) / 100);
 
-    const uint16_t remainder = (capacity % CAPACITY_GROWTH_STEP);
-    uint16_t new_capacity = (capacity - remainder);
-    if ((MAX_CAPACITY - new_capacity) < CAPACITY_GROWTH_STEP)
-        return MAX_CAPACITY;
-    new_capacity += CAPACITY_GROWTH_STEP;
-    return new_capacity;
+    if (new_capacity < MIN_CAPACITY)
+        new_capacity = MIN_CAPACITY;
+    if (new_capacity <= capacity)
+        new_capacity = ((uint64_t) capacity + 1);
+    if (new_capacity > MAX_CAPACITY)
+        new_capacity = MAX_CAPACITY;
+    return (buffer_set_size_t) new_capacity;
 }
 
-static inline uint16_t _rotate_right(
+static inline buffer_set_size_t _rotate_right(
     struct buffer_set_s * buffer_set,
-    uint16_t a_idx,
-    struct node_s * a_node
+    buffer_set_size_t a_idx,
+    struct buffer_set_node_s * a_node
 ) {
     /*       a             b
      *      / \           / \
@@ -299,9 +1339,9 @@ static inline uint16_t _rotate_right(
      *   d?  e?            e?  c?
      */
     assert(_get_node(buffer_set, a_idx) == a_node);
-    const uint16_t parent_idx = a_node->parent;
-    const uint16_t b_idx = a_node->left;
-    struct node_s * b_node = _get_node(buffer_set, b_idx);
+    const buffer_set_size_t parent_idx = a_node->parent;
+    const buffer_set_size_t b_idx = a_node->left;
+    struct buffer_set_node_s * b_node = _get_node(buffer_set, b_idx);
     a_node->parent = b_idx;
     a_node->left = b_node->right;
     // a_node->left can be NULL_IDX,
@@ -311,13 +1351,15 @@ static inline uint16_t _rotate_right(
     _get_node(buffer_set, a_node->left)->parent = a_idx;
     b_node->parent = parent_idx;
     b_node->right = a_idx;
+    _update_node(buffer_set, a_idx);
+    _update_node(buffer_set, b_idx);
     return b_idx;
 }
 
-static inline uint16_t _rotate_left(
+static inline buffer_set_size_t _rotate_left(
     struct buffer_set_s * buffer_set,
-    uint16_t a_idx,
-    struct node_s * a_node
+    buffer_set_size_t a_idx,
+    struct buffer_set_node_s * a_node
 ) {
     /*    a               b
      *   / \             / \
@@ -326,9 +1368,9 @@ static inline uint16_t _rotate_left(
      *    e?  d?      c?  e?
      */
     assert(_get_node(buffer_set, a_idx) == a_node);
-    const uint16_t parent_idx = a_node->parent;
-    const uint16_t b_idx = a_node->right;
-    struct node_s * b_node = _get_node(buffer_set, b_idx);
+    const buffer_set_size_t parent_idx = a_node->parent;
+    const buffer_set_size_t b_idx = a_node->right;
+    struct buffer_set_node_s * b_node = _get_node(buffer_set, b_idx);
     a_node->parent = b_idx;
     a_node->right = b_node->left;
     // a_node->right can be NULL_IDX,
@@ -338,17 +1380,19 @@ static inline uint16_t _rotate_left(
     _get_node(buffer_set, a_node->right)->parent = a_idx;
     b_node->parent = parent_idx;
     b_node->left = a_idx;
+    _update_node(buffer_set, a_idx);
+    _update_node(buffer_set, b_idx);
     return b_idx;
 }
 
 struct balance_result_s
 {
-    uint16_t idx;
+    buffer_set_size_t idx;
     uint16_t height_changed;
 };
 
 static inline struct balance_result_s _make_balance_result(
-    uint16_t idx,
+    buffer_set_size_t idx,
     uint16_t height_changed
 ) {
     struct balance_result_s balance_result = { idx, height_changed };
@@ -357,17 +1401,17 @@ static inline struct balance_result_s _make_balance_result(
 
 static struct balance_result_s _balance_right(
     struct buffer_set_s * buffer_set,
-    uint16_t idx,
-    struct node_s * node
+    buffer_set_size_t idx,
+    struct buffer_set_node_s * node
 ) {
     assert(_get_node(buffer_set, idx) == node);
     assert(node->balance == 2);
-    struct node_s * right_node = _get_node(buffer_set, node->right);
+    struct buffer_set_node_s * right_node = _get_node(buffer_set, node->right);
     if (right_node->balance == -1)
     {
         node->right = _rotate_right(buffer_set, node->right, right_node);
-        const uint16_t head_idx = _rotate_left(buffer_set, idx, node);
-        struct node_s * head_node = _get_node(buffer_set, head_idx);
+        const buffer_set_size_t head_idx = _rotate_left(buffer_set, idx, node);
+        struct buffer_set_node_s * head_node = _get_node(buffer_set, head_idx);
         assert((head_node->balance >= -1) && (head_node->balance <= 1));
 #if defined(USE_REFERENCE_CODE)
         if (head_node->balance == 1)
@@ -396,7 +1440,7 @@ static struct balance_result_s _balance_right(
     }
     else
     {
-        const uint16_t head_idx = _rotate_left(buffer_set, idx, node);
+        const buffer_set_size_t head_idx = _rotate_left(buffer_set, idx, node);
         assert(_get_node(buffer_set, head_idx) == right_node);
         if (right_node->balance == 0)
         {
@@ -416,18 +1460,18 @@ static struct balance_result_s _balance_right(
 
 static struct balance_result_s _balance_left(
     struct buffer_set_s * buffer_set,
-    uint16_t idx,
-    struct node_s * node
+    buffer_set_size_t idx,
+    struct buffer_set_node_s * node
 ) {
     assert(_get_node(buffer_set, idx) == node);
     assert(node->balance == -2);
 
-    struct node_s * left_node = _get_node(buffer_set, node->left);
+    struct buffer_set_node_s * left_node = _get_node(buffer_set, node->left);
     if (left_node->balance == 1)
     {
         node->left = _rotate_left(buffer_set, node->left, left_node);
-        const uint16_t head_idx = _rotate_right(buffer_set, idx, node);
-        struct node_s * head_node = _get_node(buffer_set, head_idx);
+        const buffer_set_size_t head_idx = _rotate_right(buffer_set, idx, node);
+        struct buffer_set_node_s * head_node = _get_node(buffer_set, head_idx);
         assert((head_node->balance >= -1) && (head_node->balance <= 1));
 #if defined(USE_REFERENCE_CODE)
         if (head_node->balance == -1)
@@ -456,7 +1500,7 @@ static struct balance_result_s _balance_left(
     }
     else
     {
-        const uint16_t head_idx = _rotate_right(buffer_set, idx, node);
+        const buffer_set_size_t head_idx = _rotate_right(buffer_set, idx, node);
         assert(_get_node(buffer_set, head_idx) == left_node);
         if (left_node->balance == 0)
         {
@@ -476,9 +1520,9 @@ static struct balance_result_s _balance_left(
 
 static inline void _replace_child(
     struct buffer_set_s * buffer_set,
-    uint16_t idx,
-    uint16_t old_child,
-    uint16_t new_child
+    buffer_set_size_t idx,
+    buffer_set_size_t old_child,
+    buffer_set_size_t new_child
 ) {
     if (idx == NULL_IDX)
     {
@@ -487,7 +1531,7 @@ static inline void _replace_child(
     }
     else
     {
-        struct node_s * node = _get_node(buffer_set, idx);
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
 #if defined(USE_REFERENCE_CODE)
         if (node->left == old_child)
             node->left = new_child;
@@ -504,72 +1548,226 @@ static inline void _replace_child(
     }
 }
 
-void * buffer_set_insert(
-    buffer_set_t * buffer_set,
+static void _move_nodes(
+    struct buffer_set_s * buffer_set,
+    void * dst_buffer,
+    buffer_set_size_t dst_capacity
+) {
+    // Moves all nodes of the current buffer to the new buffer with the move function
+    // (or bytewise without it) keeping their indices, dst_capacity should not be less
+    // than the current capacity.
+    const size_t node_size = buffer_set->node_size;
+    const size_t value_stride = buffer_set->value_stride;
+    char * dst_values = _get_values(buffer_set, dst_buffer, dst_capacity);
+    void (*move)(void*, void*, void*) = buffer_set->move;
+    void * thunk = buffer_set->thunk;
+    size_t offs = node_size;
+    size_t value_offs = value_stride;
+    for (size_t idx=1; idx<buffer_set->capacity; idx++, offs += node_size, value_offs += value_stride)
+    {
+        struct buffer_set_node_s * src_node = (void*) (((char*) buffer_set->buffer) + offs);
+        struct buffer_set_node_s * dst_node = (void*) (((char*) dst_buffer) + offs);
+        memcpy(dst_node, src_node, buffer_set->header_size);
+        void * src_value = ((char*) buffer_set->values) + value_offs;
+        void * dst_value = dst_values + value_offs;
+        if (move == NULL)
+            memcpy(dst_value, src_value, buffer_set->value_size);
+        else
+            move(dst_value, src_value, thunk);
+    }
+}
+
+static void * _grow_buffer(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t new_capacity,
+    size_t buffer_size
+) {
+    // Returns the buffer of the new capacity containing all nodes of the set
+    // at their indices, or NULL leaving the current buffer untouched.
+    const buffer_set_size_t capacity = buffer_set->capacity;
+    void * buffer;
+    if ((buffer_set->move == NULL) && (capacity > 0) &&
+        !(buffer_set->flags & BUFFER_SET_CONCURRENT_READS) && (buffer_set->snapshot == NULL))
+    {
+        // Values can be relocated bytewise, let the allocator extend
+        // the buffer in place if it can, avoiding the copy.
+        const size_t old_buffer_size = _get_buffer_size(buffer_set, capacity);
+        buffer = _realloc(buffer_set, buffer_set->buffer, old_buffer_size, buffer_size);
+        if (buffer && (buffer_set->flags & BUFFER_SET_SPLIT_VALUES))
+        {
+            // the value array follows the nodes, so it moves up
+            memmove(
+                _get_values(buffer_set, buffer, new_capacity),
+                _get_values(buffer_set, buffer, capacity),
+                (capacity * buffer_set->value_stride)
+            );
+        }
+    }
+    else
+    {
+        // An empty set has nothing to move, otherwise values are relocated
+        // with the move function, so the new buffer can not overlap the current one.
+        // Concurrent readers can still walk the current buffer and a snapshot
+        // can share it, so it is not reallocated in place either.
+        // The NULL buffer of an empty set can still be shared with a snapshot,
+        // it is released as well to detach the snapshot.
+        buffer = _alloc(buffer_set, buffer_size);
+        if (buffer)
+        {
+            if (capacity > 0)
+                _move_nodes(buffer_set, buffer, new_capacity);
+            _free_buffer(buffer_set, buffer_set->buffer, (capacity ? _get_buffer_size(buffer_set, capacity) : 0));
+        }
+    }
+    return buffer;
+}
+
+static buffer_set_size_t _find_leaf(
+    struct buffer_set_s * buffer_set,
     const void * value,
-    int * inserted
+    buffer_set_size_t * parent_idx,
+    int * cmp
 ) {
-    uint16_t parent_idx = NULL_IDX;
-    uint16_t idx = buffer_set->root;
-    int cmp;
+    // Returns the node with an equal value, or NULL_IDX with the parent
+    // and the side of the leaf the value would be linked as.
+    buffer_set_size_t idx = buffer_set->root;
+    *parent_idx = NULL_IDX;
+    *cmp = 0;
 
     for (;;)
     {
         if (idx == NULL_IDX)
-            break;
+            return NULL_IDX;
 
-        struct node_s * node = _get_node(buffer_set, idx);
-        void * node_value = _node_get_value(node);
-        cmp = buffer_set->compar(value, node_value, buffer_set->thunk);
-        if (cmp == 0)
-        {
-            *inserted = 0;
-            return node_value;
-        }
+        *cmp = buffer_set->compar(value, _get_value(buffer_set, idx), buffer_set->thunk);
+        if (*cmp == 0)
+            return idx;
 
-        parent_idx = idx;
-        const int side = ((cmp > 0) ? 1 : 0);
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+        *parent_idx = idx;
+        const int side = ((*cmp > 0) ? 1 : 0);
         idx = (&node->left)[side];
     }
+}
 
-    idx = buffer_set->free_list;
+static void * _insert_leaf(
+    struct buffer_set_s * buffer_set,
+    const void * value,
+    buffer_set_size_t parent_idx,
+    int cmp,
+    void (*init)(void * value, const void * key, void * ctx),
+    void * ctx
+);
+
+void * buffer_set_insert(
+    buffer_set_t * buffer_set,
+    const void * value,
+    int * inserted
+) {
+    buffer_set_size_t parent_idx;
+    int cmp;
+    const buffer_set_size_t idx = _find_leaf(buffer_set, value, &parent_idx, &cmp);
+    if (idx != NULL_IDX)
+    {
+        *inserted = 0;
+        return _get_value(buffer_set, idx);
+    }
+
+    void * ret = _insert_leaf(buffer_set, value, parent_idx, cmp, NULL, NULL);
+    *inserted = (ret != NULL);
+    return ret;
+}
+
+void * buffer_set_emplace(
+    buffer_set_t * buffer_set,
+    const void * key,
+    void (*init)(void * value, const void * key, void * ctx),
+    void * ctx
+) {
+    buffer_set_size_t parent_idx;
+    int cmp;
+    const buffer_set_size_t idx = _find_leaf(buffer_set, key, &parent_idx, &cmp);
+    if (idx != NULL_IDX)
+        return _get_value(buffer_set, idx);
+    return _insert_leaf(buffer_set, key, parent_idx, cmp, init, ctx);
+}
+
+void * buffer_set_upsert(
+    buffer_set_t * buffer_set,
+    const void * value,
+    void (*merge)(void * value, const void * other, void * ctx),
+    void * ctx
+) {
+    buffer_set_size_t parent_idx;
+    int cmp;
+    const buffer_set_size_t idx = _find_leaf(buffer_set, value, &parent_idx, &cmp);
+    if (idx == NULL_IDX)
+    {
+        void * ret = _insert_leaf(buffer_set, value, parent_idx, cmp, NULL, NULL);
+        if (ret && !buffer_set->aggregate)
+            memcpy(ret, value, buffer_set->value_size);
+        return ret;
+    }
+
+    if (_unshare(buffer_set) != 0)
+        return NULL;
+    void * ret = _get_value(buffer_set, idx);
+    merge(ret, value, ctx);
+    // the merged value can change the aggregates up to the root
+    if (buffer_set->aggregate)
+        _update_path(buffer_set, idx);
+    return ret;
+}
+
+void * buffer_set_insert_leaf(
+    buffer_set_t * buffer_set,
+    const void * value,
+    buffer_set_size_t parent_idx,
+    int cmp
+) {
+    // the position should be a free child slot of a node of the set
+    const int side = ((cmp > 0) ? 1 : 0);
+    if ((parent_idx == NULL_IDX)
+        ? (buffer_set->root != NULL_IDX)
+        : ((parent_idx >= buffer_set->capacity) || ((&_get_node(buffer_set, parent_idx)->left)[side] != NULL_IDX)))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return _insert_leaf(buffer_set, value, parent_idx, cmp, NULL, NULL);
+}
+
+static void * _insert_leaf(
+    struct buffer_set_s * buffer_set,
+    const void * value,
+    buffer_set_size_t parent_idx,
+    int cmp,
+    void (*init)(void * value, const void * key, void * ctx),
+    void * ctx
+) {
+    assert(_is_writable(buffer_set));
+    buffer_set_size_t idx = buffer_set->free_list;
+    // the growth copies the buffer shared with a snapshot anyway
+    if ((idx != NULL_IDX) && (_unshare(buffer_set) != 0))
+        return NULL;
     if (idx == NULL_IDX)
     {
         assert((buffer_set->size == 0) || ((buffer_set->size + 1) == buffer_set->capacity));
         if (buffer_set->capacity == MAX_CAPACITY)
             return NULL;
 
-        const uint16_t new_capacity = _calculate_new_capacity(buffer_set->capacity);
+        const buffer_set_size_t new_capacity = _calculate_new_capacity(buffer_set, buffer_set->capacity);
         assert(buffer_set->capacity < new_capacity);
-        void * buffer = malloc(new_capacity * buffer_set->node_size);
+        const size_t buffer_size = _get_buffer_size(buffer_set, new_capacity);
+        void * buffer = buffer_size ? _grow_buffer(buffer_set, new_capacity, buffer_size) : NULL;
         if (!buffer)
-            return NULL;
-
-        if (buffer_set->capacity > 0)
         {
-            void (*move)(void*, void*, void*) = buffer_set->move;
-            if (move)
-            {
-                void * thunk = buffer_set->thunk;
-                const size_t node_size = buffer_set->node_size;
-                size_t offs = node_size;
-                for (size_t idx=1; idx<buffer_set->capacity; idx++, offs += node_size)
-                {
-                    struct node_s * src_node = (void*) (((char*) buffer_set->buffer) + offs);
-                    struct node_s * dst_node = (void*) (((char*) buffer) + offs);
-                    *dst_node = *src_node;
-                    void * src_value = ((char*) src_node) + _round(sizeof(struct node_s));
-                    void * dst_value = ((char*) dst_node) + _round(sizeof(struct node_s));
-                    move(dst_value, src_value, thunk);
-                }
-            }
-            else
-                memcpy(buffer, buffer_set->buffer, buffer_set->capacity * buffer_set->node_size);
+            errno = ENOMEM;
+            return NULL;
         }
 
-        free(buffer_set->buffer);
-        buffer_set->capacity = new_capacity;
-        buffer_set->buffer = buffer;
+        _set_buffer(buffer_set, buffer, new_capacity);
+        _rehash(buffer_set);
 
         buffer_set->free_list = _make_free_list(
             buffer,
@@ -585,15 +1783,23 @@ void * buffer_set_insert(
     struct free_node_s * free_node = (struct free_node_s*) (((char*)buffer_set->buffer) + offs);
     buffer_set->free_list = free_node->next;
 
-    struct node_s * node = (struct node_s*) free_node;
+    struct buffer_set_node_s * node = (struct buffer_set_node_s*) free_node;
     node->left = NULL_IDX;
     node->parent = parent_idx;
     node->right = NULL_IDX;
     node->balance = 0;
-    void * ret = _node_get_value(node);
+    void * ret = _get_value(buffer_set, idx);
+    // the aggregate is calculated from the value before the insert returns
+    if (init)
+        init(ret, value, ctx);
+    else if (buffer_set->aggregate)
+        memcpy(ret, value, buffer_set->value_size);
+    _update_node(buffer_set, idx);
+    // equal values have equal hashes, so the searched value can be hashed
+    if (buffer_set->hash_index)
+        _hash_insert(buffer_set, value, idx);
 
     buffer_set->size++;
-    *inserted = 1;
 
     if (parent_idx == NULL_IDX)
     {
@@ -601,11 +1807,12 @@ void * buffer_set_insert(
         return ret;
     }
 
-    struct node_s * parent_node = _get_node(buffer_set, parent_idx);
+    struct buffer_set_node_s * parent_node = _get_node(buffer_set, parent_idx);
 #if defined(USE_REFERENCE_CODE)
     if (cmp < 0)
     {
         parent_node->left = idx;
+        _update_path(buffer_set, parent_idx);
         const int8_t balance = --parent_node->balance;
         // parent of the newly inserted node can have only balance -1 or 0 here
         if (balance == 0)
@@ -616,6 +1823,7 @@ void * buffer_set_insert(
     {
         assert(cmp > 0);
         parent_node->right = idx;
+        _update_path(buffer_set, parent_idx);
         const int8_t balance = ++parent_node->balance;
         // parent of the newly inserted node can have only balance 0 or 1 here
         if (balance == 0)
@@ -625,6 +1833,8 @@ void * buffer_set_insert(
 #else
     const int side = ((cmp > 0) ? 1 : 0);
     (&parent_node->left)[side] = idx;
+    // the path is updated before rebalancing, rotations keep the data valid
+    _update_path(buffer_set, parent_idx);
     parent_node->balance += ((cmp > 0) ? 1 : 0);
     parent_node->balance -= ((cmp < 0) ? 1 : 0);
     if (parent_node->balance == 0)
@@ -632,7 +1842,7 @@ void * buffer_set_insert(
     assert(abs(parent_node->balance) == 1);
 #endif
 
-    uint16_t from_idx = parent_idx;
+    buffer_set_size_t from_idx = parent_idx;
     idx = parent_node->parent;
     while (idx != NULL_IDX)
     {
@@ -643,7 +1853,7 @@ void * buffer_set_insert(
         else if (node->balance == -2)
         {
             assert(node->left == from_idx);
-            const uint16_t parent_idx = node->parent;
+            const buffer_set_size_t parent_idx = node->parent;
             const struct balance_result_s balance_result = _balance_left(buffer_set, idx, node);
             assert(balance_result.height_changed == 0);
             _replace_child(buffer_set, parent_idx, idx, balance_result.idx);
@@ -652,7 +1862,7 @@ void * buffer_set_insert(
         else if (node->balance == 2)
         {
             assert(node->right == from_idx);
-            const uint16_t parent_idx = node->parent;
+            const buffer_set_size_t parent_idx = node->parent;
             const struct balance_result_s balance_result = _balance_right(buffer_set, idx, node);
             assert(balance_result.height_changed == 0);
             _replace_child(buffer_set, parent_idx, idx, balance_result.idx);
@@ -666,6 +1876,45 @@ void * buffer_set_insert(
     return ret;
 }
 
+int buffer_set_insert_many(
+    buffer_set_t * buffer_set,
+    const void * values,
+    size_t count,
+    int * inserted
+) {
+    const size_t value_size = buffer_set->value_size;
+    const char * value = values;
+    buffer_set_size_t idx[BATCH_SIZE];
+    for (size_t first=0; first<count; first+=BATCH_SIZE)
+    {
+        // The batched lookup brings the nodes on the paths into the cache
+        // and filters out the values already present in the set,
+        // the remaining values are inserted one by one since each insertion
+        // can change the tree.
+        const size_t batch_size = ((count - first) < BATCH_SIZE) ? (count - first) : BATCH_SIZE;
+        _find_batch(buffer_set, value, batch_size, idx);
+        for (size_t jdx=0; jdx<batch_size; jdx++, value+=value_size)
+        {
+            int value_inserted = 0;
+            if (idx[jdx] == NULL_IDX)
+            {
+                void * ptr = buffer_set_insert(buffer_set, value, &value_inserted);
+                if (ptr == NULL)
+                {
+                    if (inserted)
+                        memset(&inserted[first + jdx], 0, sizeof(int) * (count - first - jdx));
+                    return -1;
+                }
+                if (value_inserted)
+                    memcpy(ptr, value, value_size);
+            }
+            if (inserted)
+                inserted[first + jdx] = value_inserted;
+        }
+    }
+    return 0;
+}
+
 void * buffer_set_erase(
     buffer_set_t * buffer_set,
     const void * value
@@ -677,21 +1926,33 @@ void * buffer_set_erase(
         return buffer_set_erase_at(buffer_set, it);
 }
 
+void * buffer_set_erase_by_key(
+    buffer_set_t * buffer_set,
+    const void * key,
+    int (*key_compar)(const void * key, const void * value, void * thunk)
+) {
+    buffer_set_iterator_t * it = buffer_set_find_by_key(buffer_set, key, key_compar);
+    if (it == buffer_set_end(buffer_set))
+        return NULL;
+    else
+        return buffer_set_erase_at(buffer_set, it);
+}
+
 static void _replace_child_and_rebalance(
     struct buffer_set_s * buffer_set,
-    uint16_t idx,
-    uint16_t old_child,
-    uint16_t new_child
+    buffer_set_size_t idx,
+    buffer_set_size_t old_child,
+    buffer_set_size_t new_child
 );
 
 static void _rebalance(
     struct buffer_set_s * buffer_set,
-    uint16_t idx,
-    uint16_t from_child
+    buffer_set_size_t idx,
+    buffer_set_size_t from_child
 ) {
     while (idx != NULL_IDX)
     {
-        struct node_s * node = _get_node(buffer_set, idx);
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
         const int8_t balance_change = (node->left == from_child) ? -1 : 1;
         node->balance -= balance_change;
         if (abs(node->balance) == 1)
@@ -702,7 +1963,7 @@ static void _rebalance(
         else if (node->balance == 2)
         {
             assert(node->left == from_child);
-            const uint16_t parent_idx = node->parent;
+            const buffer_set_size_t parent_idx = node->parent;
             const struct balance_result_s balance_result = _balance_right(buffer_set, idx, node);
             const uint16_t height_changed = !balance_result.height_changed;
             if (height_changed)
@@ -714,7 +1975,7 @@ static void _rebalance(
         else if (node->balance == -2)
         {
             assert(node->right == from_child);
-            const uint16_t parent_idx = node->parent;
+            const buffer_set_size_t parent_idx = node->parent;
             const struct balance_result_s balance_result = _balance_left(buffer_set, idx, node);
             const uint16_t height_changed = !balance_result.height_changed;
             if (height_changed)
@@ -731,9 +1992,9 @@ static void _rebalance(
 
 static void _replace_child_and_rebalance(
     struct buffer_set_s * buffer_set,
-    uint16_t idx,
-    uint16_t old_child,
-    uint16_t new_child
+    buffer_set_size_t idx,
+    buffer_set_size_t old_child,
+    buffer_set_size_t new_child
 ) {
     if (idx == NULL_IDX)
     {
@@ -742,7 +2003,7 @@ static void _replace_child_and_rebalance(
     }
     else
     {
-        struct node_s * node = _get_node(buffer_set, idx);
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
         const int8_t balance_change = ((node->left == old_child) ? -1 : 1);
         const int side = ((node->left == old_child) ? 0 : 1);
         (&node->left)[side] = new_child;
@@ -755,7 +2016,7 @@ static void _replace_child_and_rebalance(
         else if (node->balance == 2)
         {
             assert(node->left == new_child);
-            const uint16_t parent_idx = node->parent;
+            const buffer_set_size_t parent_idx = node->parent;
             const struct balance_result_s balance_result = _balance_right(buffer_set, idx, node);
             const uint16_t height_changed = !balance_result.height_changed;
             if (height_changed)
@@ -767,7 +2028,7 @@ static void _replace_child_and_rebalance(
         else if (node->balance == -2)
         {
             assert(node->right == new_child);
-            const uint16_t parent_idx = node->parent;
+            const buffer_set_size_t parent_idx = node->parent;
             const struct balance_result_s balance_result = _balance_left(buffer_set, idx, node);
             const uint16_t height_changed = !balance_result.height_changed;
             if (height_changed)
@@ -777,7 +2038,7 @@ static void _replace_child_and_rebalance(
             return;
         }
         assert(node->balance == 0);
-        const uint16_t parent = node->parent;
+        const buffer_set_size_t parent = node->parent;
         if (parent != NULL_IDX)
             _rebalance(buffer_set, parent, idx);
     }
@@ -787,14 +2048,22 @@ void * buffer_set_erase_at(
     buffer_set_t * buffer_set,
     buffer_set_iterator_t * it
 ) {
-    struct node_s * node = (struct node_s*) it;
-    const ptrdiff_t offs = (((const char*)node) - ((const char*)buffer_set->buffer));
-    assert((offs % buffer_set->node_size) == 0);
-    const uint16_t idx = (uint16_t) (offs / buffer_set->node_size);
+    assert(_is_writable(buffer_set));
+    const buffer_set_size_t idx = _get_node_idx(buffer_set, (struct buffer_set_node_s*) it);
+    if (_unshare(buffer_set) != 0)
+        return NULL;
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+    if (buffer_set->hash_index)
+        _hash_remove(buffer_set, idx);
+    // The lowest node with a changed subtree, the augmented data is
+    // recalculated from it up to the root after rebalancing. Rotations update
+    // the nodes they move from their children, the nodes with outdated
+    // children remain on the path from this node to the root.
+    buffer_set_size_t update_idx;
     if ((node->left != NULL_IDX) && (node->right != NULL_IDX))
     {
-        uint16_t tmp_idx = node->right;
-        struct node_s * tmp_node = _get_node(buffer_set, tmp_idx);
+        buffer_set_size_t tmp_idx = node->right;
+        struct buffer_set_node_s * tmp_node = _get_node(buffer_set, tmp_idx);
         for (;;)
         {
             if (tmp_node->left == NULL_IDX)
@@ -803,7 +2072,7 @@ void * buffer_set_erase_at(
             tmp_node = _get_node(buffer_set, tmp_idx);
         }
 
-        const uint16_t tmp_parent_idx = tmp_node->parent;
+        const buffer_set_size_t tmp_parent_idx = tmp_node->parent;
         tmp_node->left = node->left;
         _get_node(buffer_set, node->left)->parent = tmp_idx;
         _get_node(buffer_set, node->right)->parent = tmp_idx;
@@ -812,6 +2081,7 @@ void * buffer_set_erase_at(
 
         if (tmp_idx == node->right)
         {
+            update_idx = tmp_idx;
             const int8_t balance = --tmp_node->balance;
             if (balance == -2)
             {
@@ -835,7 +2105,8 @@ void * buffer_set_erase_at(
         }
         else
         {
-            const uint16_t tmp_right_idx = tmp_node->right;
+            update_idx = tmp_parent_idx;
+            const buffer_set_size_t tmp_right_idx = tmp_node->right;
             tmp_node->right = node->right;
             _replace_child(buffer_set, tmp_node->parent, idx, tmp_idx);
             _get_node(buffer_set, tmp_right_idx)->parent = tmp_parent_idx;
@@ -845,7 +2116,8 @@ void * buffer_set_erase_at(
     else if (node->left != NULL_IDX)
     {
         // node->right == NULL_IDX
-        const uint16_t parent = node->parent;
+        const buffer_set_size_t parent = node->parent;
+        update_idx = parent;
         _get_node(buffer_set, node->left)->parent = parent;
         _replace_child_and_rebalance(buffer_set, parent, idx, node->left);
     }
@@ -855,47 +2127,50 @@ void * buffer_set_erase_at(
         // node->right can be either NULL_IDX or not
         // since we have a special dummy node at 0,
         // we can safely set the parent there instead of branching
-        const uint16_t parent = node->parent;
+        const buffer_set_size_t parent = node->parent;
+        update_idx = parent;
         _get_node(buffer_set, node->right)->parent = parent;
         _replace_child_and_rebalance(buffer_set, parent, idx, node->right);
     }
 
+    _update_path(buffer_set, update_idx);
+
     buffer_set->size--;
     struct free_node_s * free_node = (struct free_node_s*) node;
     free_node->next = buffer_set->free_list;
     buffer_set->free_list = idx;
 
-    return _node_get_value(node);
+    return _get_value(buffer_set, idx);
 }
 
 static void _buffer_set_print_debug(
     struct buffer_set_s * buffer_set,
     FILE * file,
     void (*value_printer)(FILE *, const void *),
-    uint16_t idx
+    buffer_set_size_t idx
 ) {
-    struct node_s * node = _get_node(buffer_set, idx);
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
     fprintf(file, "    ");
-    value_printer(file, _node_get_value(node));
-    fprintf(file, "/%hu", idx);
+    value_printer(file, _get_value(buffer_set, idx));
+    fprintf(file, "/%" IDX_FMT, idx);
 
     fprintf(file, ": parent=");
     if (node->parent == NULL_IDX)
         fprintf(file, "NIL");
     else
-        fprintf(file, "%hu", node->parent);
+        fprintf(file, "%" IDX_FMT, node->parent);
 
     fprintf(file, " left=");
     if (node->left == NULL_IDX)
         fprintf(file, "NIL");
     else
-        fprintf(file, "%hu", node->left);
+        fprintf(file, "%" IDX_FMT, node->left);
 
     fprintf(file, " right=");
     if (node->right == NULL_IDX)
         fprintf(file, "NIL");
     else
-        fprintf(file, "%hu", node->right);
+        fprintf(file, "%" IDX_FMT, node->right);
 
     fprintf(file, " balance=%hhd\n", node->balance);
 
@@ -912,7 +2187,7 @@ void buffer_set_print_debug(
     void (*value_printer)(FILE * file, const void * value)
 ) {
     fprintf(file, "{");
-    const uint16_t root = buffer_set->root;
+    const buffer_set_size_t root = buffer_set->root;
     if (root != NULL_IDX)
     {
         fprintf(file, "\n");
@@ -924,28 +2199,28 @@ void buffer_set_print_debug(
 static int _buffer_set_verify(
     buffer_set_t * buffer_set,
     FILE * file,
-    uint16_t idx,
+    buffer_set_size_t idx,
     int * height
 ) {
-    struct node_s * node = _get_node(buffer_set, idx);
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
     int left_height = 0;
     if (node->left != NULL_IDX)
     {
-        struct node_s * left_node = _get_node(buffer_set, node->left);
+        struct buffer_set_node_s * left_node = _get_node(buffer_set, node->left);
         if (left_node->parent != idx)
         {
-            fprintf(file, "left_node->parent(%hu)!=idx(%hu)\n", left_node->parent, idx);
+            fprintf(file, "left_node->parent(%" IDX_FMT ")!=idx(%" IDX_FMT ")\n", left_node->parent, idx);
             return -1;
         }
         const int cmp = buffer_set->compar(
-            _node_get_value(left_node),
-            _node_get_value(node),
+            _get_value(buffer_set, node->left),
+            _get_value(buffer_set, idx),
             buffer_set->thunk
         );
         assert(cmp < 0);
         if (cmp >= 0)
         {
-            fprintf(file, "left node (%hu) value is not less than value in (%hu)\n", node->left, idx);
+            fprintf(file, "left node (%" IDX_FMT ") value is not less than value in (%" IDX_FMT ")\n", node->left, idx);
             return -1;
         }
         int rc = _buffer_set_verify(buffer_set, file, node->left, &left_height);
@@ -956,21 +2231,21 @@ static int _buffer_set_verify(
     int right_height = 0;
     if (node->right != NULL_IDX)
     {
-        struct node_s * right_node = _get_node(buffer_set, node->right);
+        struct buffer_set_node_s * right_node = _get_node(buffer_set, node->right);
         if (right_node->parent != idx)
         {
-            fprintf(file, "right_node->parent(%hu)!=idx(%hu)\n", right_node->parent, idx);
+            fprintf(file, "right_node->parent(%" IDX_FMT ")!=idx(%" IDX_FMT ")\n", right_node->parent, idx);
             return -1;
         }
         const int cmp = buffer_set->compar(
-            _node_get_value(node),
-            _node_get_value(right_node),
+            _get_value(buffer_set, idx),
+            _get_value(buffer_set, node->right),
             buffer_set->thunk
         );
         assert(cmp < 0);
         if (cmp >= 0)
         {
-            fprintf(file, "right node (%hu) value is not greater than value in (%hu)\n", node->left, idx);
+            fprintf(file, "right node (%" IDX_FMT ") value is not greater than value in (%" IDX_FMT ")\n", node->left, idx);
             return -1;
         }
         int rc = _buffer_set_verify(buffer_set, file, node->right, &right_height);
@@ -983,10 +2258,23 @@ static int _buffer_set_verify(
 
     if (node->balance != balance)
     {
-        fprintf(file, "unexpected balance %hhd instead of %d for node %hu\n", node->balance, balance, idx);
+        fprintf(file, "unexpected balance %hhd instead of %d for node %" IDX_FMT "\n", node->balance, balance, idx);
         return -1;
     }
 
+    if (buffer_set->flags & BUFFER_SET_ORDER_STATISTICS)
+    {
+        const buffer_set_size_t count = *_get_count(buffer_set, idx);
+        const buffer_set_size_t expected_count = (buffer_set_size_t)
+            (1 + *_get_count(buffer_set, node->left) + *_get_count(buffer_set, node->right));
+        if (count != expected_count)
+        {
+            fprintf(file, "unexpected subtree size %" IDX_FMT " instead of %" IDX_FMT " for node %" IDX_FMT "\n",
+                count, expected_count, idx);
+            return -1;
+        }
+    }
+
     *height = (left_height > right_height) ? left_height : right_height;
     *height += 1;
     return 0;
@@ -999,17 +2287,49 @@ int buffer_set_verify(
     if (buffer_set->root != NULL_IDX)
     {
         int height = 0;
-        return _buffer_set_verify(buffer_set, file, buffer_set->root, &height);
+        const int rc = _buffer_set_verify(buffer_set, file, buffer_set->root, &height);
+        if (rc != 0)
+            return rc;
+        if ((buffer_set->flags & BUFFER_SET_ORDER_STATISTICS) &&
+            (*_get_count(buffer_set, buffer_set->root) != buffer_set->size))
+        {
+            fprintf(file, "root subtree size differs from the set size\n");
+            return -1;
+        }
+    }
+
+    if (buffer_set->hash_index)
+    {
+        // every node of the tree should be found through the hash index,
+        // and the index should not contain anything else
+        size_t count = 0;
+        for (size_t pos=0; pos<=buffer_set->hash_mask; pos++)
+        {
+            const buffer_set_size_t idx = buffer_set->hash_index[pos];
+            if (idx == NULL_IDX)
+                continue;
+            count++;
+            if (_hash_find(buffer_set, _get_value(buffer_set, idx)) != idx)
+            {
+                fprintf(file, "node %" IDX_FMT " is not reachable through the hash index\n", idx);
+                return -1;
+            }
+        }
+        if (count != buffer_set->size)
+        {
+            fprintf(file, "hash index contains %zu nodes instead of %" IDX_FMT "\n", count, buffer_set->size);
+            return -1;
+        }
     }
     return 0;
 }
 
-static uint16_t _buffer_set_clear(
+static buffer_set_size_t _buffer_set_clear(
     struct buffer_set_s * buffer_set,
-    uint16_t free_list,
-    uint16_t idx
+    buffer_set_size_t free_list,
+    buffer_set_size_t idx
 ) {
-    struct node_s * node = _get_node(buffer_set, idx);
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
     if (node->left != NULL_IDX)
         free_list = _buffer_set_clear(buffer_set, free_list, node->left);
     if (node->right != NULL_IDX)
@@ -1019,55 +2339,151 @@ static uint16_t _buffer_set_clear(
     return idx;
 }
 
-static uint16_t _buffer_set_move_tree(
+static buffer_set_size_t _buffer_set_move_tree(
     buffer_set_t * buffer_set,
-    uint16_t src_idx,
-    void * src_buffer
+    buffer_set_size_t src_idx,
+    void * src_buffer,
+    void * src_values
 ) {
-    uint16_t idx = ++buffer_set->size;
+    buffer_set_size_t idx = ++buffer_set->size;
     size_t node_size = buffer_set->node_size;
-    struct node_s * dst_node = _get_node(buffer_set, idx);
-    struct node_s * src_node = (void*) (((char*)src_buffer) + (src_idx * node_size));
+    struct buffer_set_node_s * dst_node = _get_node(buffer_set, idx);
+    struct buffer_set_node_s * src_node = (void*) (((char*)src_buffer) + (src_idx * node_size));
 
-    uint16_t left = src_node->left;
+    buffer_set_size_t left = src_node->left;
     if (left != NULL_IDX)
     {
-        left = _buffer_set_move_tree(buffer_set, left, src_buffer);
-        struct node_s * left_node = _get_node(buffer_set, left);
+        left = _buffer_set_move_tree(buffer_set, left, src_buffer, src_values);
+        struct buffer_set_node_s * left_node = _get_node(buffer_set, left);
         left_node->parent = idx;
     }
     dst_node->left = left;
 
-    uint16_t right = src_node->right;
+    buffer_set_size_t right = src_node->right;
     if (right != NULL_IDX)
     {
-        right = _buffer_set_move_tree(buffer_set, right, src_buffer);
-        struct node_s * right_node = _get_node(buffer_set, right);
+        right = _buffer_set_move_tree(buffer_set, right, src_buffer, src_values);
+        struct buffer_set_node_s * right_node = _get_node(buffer_set, right);
         right_node->parent = idx;
     }
     dst_node->right = right;
 
     dst_node->balance = src_node->balance;
 
+    void * dst_value = _get_value(buffer_set, idx);
+    void * src_value = ((char*)src_values) + (src_idx * buffer_set->value_stride);
     void (*move)(void*, void*, void*) = buffer_set->move;
     if (move == NULL)
-    {
-        size_t value_size = (node_size - _round(sizeof(struct node_s)));
-        memcpy(
-            _node_get_value(dst_node),
-            _node_get_value(src_node),
-            value_size
-        );
-    }
+        memcpy(dst_value, src_value, buffer_set->value_size);
     else
-        move(dst_node, src_node, buffer_set->thunk);
+        move(dst_value, src_value, buffer_set->thunk);
 
+    _update_node(buffer_set, idx);
     return idx;
 }
 
+static void _relocate_node(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t src_idx,
+    buffer_set_size_t dst_idx
+) {
+    struct buffer_set_node_s * src_node = _get_node(buffer_set, src_idx);
+    struct buffer_set_node_s * dst_node = _get_node(buffer_set, dst_idx);
+    memcpy(dst_node, src_node, buffer_set->header_size);
+    memcpy(_get_value(buffer_set, dst_idx), _get_value(buffer_set, src_idx), buffer_set->value_size);
+    _replace_child(buffer_set, dst_node->parent, src_idx, dst_idx);
+    // children can be NULL_IDX, dummy node 0 takes the parent then
+    _get_node(buffer_set, dst_node->left)->parent = dst_idx;
+    _get_node(buffer_set, dst_node->right)->parent = dst_idx;
+}
+
+static void _compact_tree(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx,
+    buffer_set_size_t capacity
+) {
+    // Moves all nodes of the subtree located at or above the capacity
+    // to the free nodes below it, the free list should contain only such nodes.
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+    if (node->left != NULL_IDX)
+        _compact_tree(buffer_set, node->left, capacity);
+    if (node->right != NULL_IDX)
+        _compact_tree(buffer_set, node->right, capacity);
+    if (idx >= capacity)
+    {
+        const buffer_set_size_t free_idx = buffer_set->free_list;
+        assert((free_idx != NULL_IDX) && (free_idx < capacity));
+        buffer_set->free_list = _get_free_node(buffer_set, free_idx)->next;
+        _relocate_node(buffer_set, idx, free_idx);
+    }
+}
+
+static void _shrink_in_place(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t new_capacity
+) {
+    // Drop the free nodes which are going to be cut off from the free list
+    buffer_set_size_t free_list = NULL_IDX;
+    buffer_set_size_t idx = buffer_set->free_list;
+    while (idx != NULL_IDX)
+    {
+        struct free_node_s * free_node = _get_free_node(buffer_set, idx);
+        const buffer_set_size_t next = free_node->next;
+        if (idx < new_capacity)
+        {
+            free_node->next = free_list;
+            free_list = idx;
+        }
+        idx = next;
+    }
+    buffer_set->free_list = free_list;
+
+    if (buffer_set->root != NULL_IDX)
+        _compact_tree(buffer_set, buffer_set->root, new_capacity);
+
+    if (buffer_set->flags & BUFFER_SET_SPLIT_VALUES)
+    {
+        // the value array follows the nodes, so it moves down as well
+        void * values = _get_values(buffer_set, buffer_set->buffer, new_capacity);
+        memmove(values, buffer_set->values, (buffer_set->value_stride * new_capacity));
+    }
+
+    // If realloc() fails the original (larger) buffer is still valid
+    // and already contains the compacted set.
+    void * buffer = _realloc(
+        buffer_set,
+        buffer_set->buffer,
+        _get_buffer_size(buffer_set, buffer_set->capacity),
+        _get_buffer_size(buffer_set, new_capacity)
+    );
+    if (buffer == NULL)
+    {
+        // keep the original capacity, the nodes cut off become free
+        const buffer_set_size_t capacity = buffer_set->capacity;
+        if (buffer_set->flags & BUFFER_SET_SPLIT_VALUES)
+        {
+            void * values = _get_values(buffer_set, buffer_set->buffer, new_capacity);
+            memmove(buffer_set->values, values, (buffer_set->value_stride * new_capacity));
+        }
+        const buffer_set_size_t first_idx = _make_free_list(
+            buffer_set->buffer,
+            buffer_set->node_size,
+            new_capacity,
+            (capacity - new_capacity)
+        );
+        _get_free_node(buffer_set, capacity - 1)->next = buffer_set->free_list;
+        buffer_set->free_list = first_idx;
+        _rehash(buffer_set);
+        return;
+    }
+    _set_buffer(buffer_set, buffer, new_capacity);
+    _rehash(buffer_set);
+}
+
 void buffer_set_shrink(buffer_set_t * buffer_set)
 {
-    uint16_t new_capacity = buffer_set->capacity;
+    assert(_is_writable(buffer_set));
+    buffer_set_size_t new_capacity = buffer_set->capacity;
     while ((buffer_set->size + 1) < (new_capacity / 4))
         new_capacity /= 2;
 
@@ -1078,25 +2494,41 @@ void buffer_set_shrink(buffer_set_t * buffer_set)
             return;
     }
 
-    void * buffer = malloc(buffer_set->node_size * new_capacity);
+    if (new_capacity == buffer_set->capacity)
+        return;
+
+    if ((buffer_set->move == NULL) &&
+        !(buffer_set->flags & BUFFER_SET_CONCURRENT_READS) && (buffer_set->snapshot == NULL))
+    {
+        // Values can be relocated bytewise, so the nodes located above
+        // the new capacity are moved down in place and the buffer is truncated,
+        // without allocating a second buffer.
+        _shrink_in_place(buffer_set, new_capacity);
+        return;
+    }
+
+    // Values have to be relocated with the move callback, the buffer can not be
+    // truncated with realloc() then since it could move the data as well.
+    void * buffer = _alloc(buffer_set, _get_buffer_size(buffer_set, new_capacity));
     if (buffer == NULL)
         return;
 
     void * old_buffer = buffer_set->buffer;
-    buffer_set->buffer = buffer;
-    buffer_set->capacity = new_capacity;
+    void * old_values = buffer_set->values;
+    const size_t old_buffer_size = _get_buffer_size(buffer_set, buffer_set->capacity);
+    _set_buffer(buffer_set, buffer, new_capacity);
 
-    uint16_t root = buffer_set->root;
+    buffer_set_size_t root = buffer_set->root;
     if (root != NULL_IDX)
     {
         buffer_set->size = 0;
-        root = _buffer_set_move_tree(buffer_set, root, old_buffer);
+        root = _buffer_set_move_tree(buffer_set, root, old_buffer, old_values);
         buffer_set->root = root;
-        struct node_s * node = _get_node(buffer_set, root);
+        struct buffer_set_node_s * node = _get_node(buffer_set, root);
         node->parent = NULL_IDX;
     }
 
-    free(old_buffer);
+    _free_buffer(buffer_set, old_buffer, old_buffer_size);
 
     buffer_set->free_list = _make_free_list(
         buffer,
@@ -1104,21 +2536,1139 @@ void buffer_set_shrink(buffer_set_t * buffer_set)
         buffer_set->size + 1,
         (new_capacity - buffer_set->size - 1)
     );
+    _rehash(buffer_set);
 }
 
-void buffer_set_clear(buffer_set_t * buffer_set)
+static buffer_set_size_t _build_balanced(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t first_idx,
+    buffer_set_size_t count,
+    buffer_set_size_t parent_idx,
+    int * height
+) {
+    // Links nodes [first_idx, first_idx + count) which hold values in ascending order
+    // into a perfectly balanced tree, sizes of the subtrees differ at most by one,
+    // so do their heights.
+    if (count == 0)
+    {
+        *height = 0;
+        return NULL_IDX;
+    }
+
+    const buffer_set_size_t left_count = (count / 2);
+    const buffer_set_size_t idx = (first_idx + left_count);
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+    int left_height;
+    int right_height;
+    node->parent = parent_idx;
+    node->left = _build_balanced(buffer_set, first_idx, left_count, idx, &left_height);
+    node->right = _build_balanced(buffer_set, idx + 1, count - left_count - 1, idx, &right_height);
+    node->balance = (int8_t) (right_height - left_height);
+    _update_node(buffer_set, idx);
+    *height = ((left_height > right_height) ? left_height : right_height) + 1;
+    return idx;
+}
+
+int buffer_set_build_sorted(
+    buffer_set_t * buffer_set,
+    const void * values,
+    size_t count
+) {
+    assert(_is_writable(buffer_set));
+    if (count >= MAX_CAPACITY)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    const size_t value_size = buffer_set->value_size;
+    const char * value = values;
+    for (size_t idx=1; idx<count; idx++, value+=value_size)
+    {
+        if (buffer_set->compar(value, value + value_size, buffer_set->thunk) >= 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    const buffer_set_size_t capacity = (buffer_set_size_t) (count + 1);
+    if ((buffer_set->capacity >= capacity) && (_unshare(buffer_set) != 0))
+        return -1;
+    if (buffer_set->capacity < capacity)
+    {
+        // current content is discarded, nothing to copy
+        const buffer_set_size_t new_capacity = (capacity < MIN_CAPACITY) ? MIN_CAPACITY : capacity;
+        const size_t buffer_size = _get_buffer_size(buffer_set, new_capacity);
+        void * buffer = buffer_size ? _alloc(buffer_set, buffer_size) : NULL;
+        if (buffer == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        _free_buffer(buffer_set, buffer_set->buffer, _get_buffer_size(buffer_set, buffer_set->capacity));
+        _set_buffer(buffer_set, buffer, new_capacity);
+    }
+
+    value = values;
+    for (buffer_set_size_t idx=1; idx<capacity; idx++, value+=value_size)
+        memcpy(_get_value(buffer_set, idx), value, value_size);
+
+    int height;
+    buffer_set->root = _build_balanced(buffer_set, 1, (buffer_set_size_t) count, NULL_IDX, &height);
+    buffer_set->size = (buffer_set_size_t) count;
+    buffer_set->free_list = _make_free_list(
+        buffer_set->buffer,
+        buffer_set->node_size,
+        capacity,
+        (buffer_set->capacity - capacity)
+    );
+    _rehash(buffer_set);
+    return 0;
+}
+
+static buffer_set_t * _create_like(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t size
+) {
+    // Creates an empty set with the options of the given one
+    // and the capacity for size values.
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = buffer_set->value_size;
+    options.initial_capacity = (buffer_set_size_t) (size + 1);
+    if (options.initial_capacity < MIN_CAPACITY)
+        options.initial_capacity = MIN_CAPACITY;
+    options.compar = buffer_set->compar;
+    options.move = buffer_set->move;
+    options.thunk = buffer_set->thunk;
+    // the new set is writable even if the given one is a snapshot
+    options.flags = (buffer_set->flags & ~SNAPSHOT_VIEW);
+    options.allocator = &buffer_set->allocator;
+    options.growth_factor = buffer_set->growth_factor;
+    options.growth_step = buffer_set->growth_step;
+    options.grow = buffer_set->grow;
+    options.aggregate_size = buffer_set->aggregate ? (buffer_set->header_size - buffer_set->aggregate_offset) : 0;
+    options.aggregate = buffer_set->aggregate;
+    options.hash = buffer_set->hash;
+    options.max_readers = buffer_set->max_readers;
+    return buffer_set_create_ex(&options);
+}
+
+static void _link_sorted(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t count
+) {
+    // Links the values copied in ascending order into the nodes [1, count]
+    // of an empty set into a balanced tree.
+    int height;
+    buffer_set->root = _build_balanced(buffer_set, 1, count, NULL_IDX, &height);
+    buffer_set->size = count;
+    buffer_set->free_list = _make_free_list(
+        buffer_set->buffer,
+        buffer_set->node_size,
+        (count + 1),
+        (buffer_set->capacity - count - 1)
+    );
+    _rehash(buffer_set);
+}
+
+// Parts of the merged sets taken into the result of a set operation
+#define MERGE_ONLY_A 0x01
+#define MERGE_ONLY_B 0x02
+#define MERGE_BOTH   0x04
+
+static buffer_set_t * _merge(
+    buffer_set_t * a,
+    buffer_set_t * b,
+    unsigned int parts
+) {
+    // Merges the in-order traversals of both sets into consecutive nodes
+    // of a new set created with the options of the first one,
+    // then links them into a balanced tree, O(n + m) in total.
+    if ((a->compar != b->compar) || (a->value_size != b->value_size))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // the capacity is enough for the largest possible result
+    size_t max_size = 0;
+    if (parts & MERGE_ONLY_A)
+        max_size += a->size;
+    if (parts & MERGE_ONLY_B)
+        max_size += b->size;
+    if (parts == MERGE_BOTH)
+        max_size = ((a->size < b->size) ? a->size : b->size);
+    if (max_size >= MAX_CAPACITY)
+        max_size = (MAX_CAPACITY - 1);
+
+    buffer_set_t * result = _create_like(a, (buffer_set_size_t) max_size);
+    if (result == NULL)
+        return NULL;
+    // a new set has no snapshot, the write section can not fail
+    buffer_set_write_begin(result);
+
+    const size_t value_size = a->value_size;
+    buffer_set_size_t count = 0;
+    buffer_set_cursor_t cursor_a;
+    buffer_set_cursor_t cursor_b;
+    const void * value_a = buffer_set_cursor_first(a, &cursor_a);
+    const void * value_b = buffer_set_cursor_first(b, &cursor_b);
+    for (;;)
+    {
+        // stop as soon as the rest of the other set can not get into the result
+        if (((value_a == NULL) || (value_b == NULL)) &&
+            ((value_a == NULL) || !(parts & MERGE_ONLY_A)) &&
+            ((value_b == NULL) || !(parts & MERGE_ONLY_B)))
+        {
+            break;
+        }
+
+        const void * value = NULL;
+        const int cmp = (value_a == NULL) ? 1 : (value_b == NULL) ? -1 : a->compar(value_a, value_b, a->thunk);
+        if (cmp < 0)
+        {
+            if (parts & MERGE_ONLY_A)
+                value = value_a;
+            value_a = buffer_set_cursor_next(a, &cursor_a);
+        }
+        else if (cmp > 0)
+        {
+            if (parts & MERGE_ONLY_B)
+                value = value_b;
+            value_b = buffer_set_cursor_next(b, &cursor_b);
+        }
+        else
+        {
+            if (parts & MERGE_BOTH)
+                value = value_a;
+            value_a = buffer_set_cursor_next(a, &cursor_a);
+            value_b = buffer_set_cursor_next(b, &cursor_b);
+        }
+
+        if (value)
+        {
+            if (count == (MAX_CAPACITY - 1))
+            {
+                buffer_set_destroy(result);
+                errno = ENOMEM;
+                return NULL;
+            }
+            memcpy(_get_value(result, ++count), value, value_size);
+        }
+    }
+
+    _link_sorted(result, count);
+    buffer_set_write_end(result);
+    return result;
+}
+
+buffer_set_t * buffer_set_union(buffer_set_t * a, buffer_set_t * b)
 {
-    const uint16_t root = buffer_set->root;
-    if (root != NULL_IDX)
+    return _merge(a, b, (MERGE_ONLY_A | MERGE_ONLY_B | MERGE_BOTH));
+}
+
+buffer_set_t * buffer_set_intersect(buffer_set_t * a, buffer_set_t * b)
+{
+    return _merge(a, b, MERGE_BOTH);
+}
+
+buffer_set_t * buffer_set_difference(buffer_set_t * a, buffer_set_t * b)
+{
+    return _merge(a, b, MERGE_ONLY_A);
+}
+
+static buffer_set_size_t _build_balanced_nodes(
+    struct buffer_set_s * buffer_set,
+    const buffer_set_size_t * nodes,
+    buffer_set_size_t count,
+    buffer_set_size_t parent_idx,
+    int * height
+) {
+    // Same as _build_balanced(), but the nodes holding values in ascending
+    // order are listed in the array instead of being consecutive.
+    if (count == 0)
     {
-        buffer_set->free_list = _buffer_set_clear(buffer_set, buffer_set->free_list, root);
-        buffer_set->root = NULL_IDX;
-        buffer_set->size = 0;
+        *height = 0;
+        return NULL_IDX;
     }
+
+    const buffer_set_size_t left_count = (count / 2);
+    const buffer_set_size_t idx = nodes[left_count];
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+    int left_height;
+    int right_height;
+    node->parent = parent_idx;
+    node->left = _build_balanced_nodes(buffer_set, nodes, left_count, idx, &left_height);
+    node->right = _build_balanced_nodes(buffer_set, nodes + left_count + 1, count - left_count - 1, idx, &right_height);
+    node->balance = (int8_t) (right_height - left_height);
+    _update_node(buffer_set, idx);
+    *height = ((left_height > right_height) ? left_height : right_height) + 1;
+    return idx;
 }
 
-void buffer_set_destroy(buffer_set_t * buffer_set)
+static void _rebuild(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t * nodes,
+    buffer_set_size_t kept
+) {
+    assert(_is_writable(buffer_set));
+    // The first kept nodes of the array are the remaining ones in ascending
+    // order, the rest of the array up to the set size lists the erased ones.
+    for (buffer_set_size_t pos=kept; pos<buffer_set->size; pos++)
+    {
+        const buffer_set_size_t idx = nodes[pos];
+        _get_free_node(buffer_set, idx)->next = buffer_set->free_list;
+        buffer_set->free_list = idx;
+    }
+
+    int height;
+    buffer_set->root = _build_balanced_nodes(buffer_set, nodes, kept, NULL_IDX, &height);
+    buffer_set->size = kept;
+    _rehash(buffer_set);
+}
+
+static buffer_set_size_t _erase_nodes(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx,
+    buffer_set_size_t count
+) {
+    // Erases count nodes one by one starting from idx in ascending order,
+    // erase does not move the nodes, so the next node remains valid.
+    buffer_set_iterator_t * it = (buffer_set_iterator_t*) _get_node(buffer_set, idx);
+    for (buffer_set_size_t erased=0; erased<count; erased++)
+    {
+        buffer_set_iterator_t * next = buffer_set_iterator_next(buffer_set, it);
+        buffer_set_erase_at(buffer_set, it);
+        it = next;
+    }
+    return count;
+}
+
+buffer_set_size_t buffer_set_erase_range(
+    buffer_set_t * buffer_set,
+    const void * lo,
+    const void * hi
+) {
+    buffer_set_iterator_t * first = lo ? buffer_set_lower_bound(buffer_set, lo) : buffer_set_begin(buffer_set);
+    buffer_set_iterator_t * it_end = buffer_set_end(buffer_set);
+    buffer_set_size_t count = 0;
+    for (buffer_set_iterator_t * it=first; it!=it_end; it=buffer_set_iterator_next(buffer_set, it))
+    {
+        if (hi && (buffer_set->compar(buffer_set_get_at(buffer_set, it), hi, buffer_set->thunk) >= 0))
+            break;
+        count++;
+    }
+
+    if (count == 0)
+        return 0;
+
+    const buffer_set_size_t first_idx = _get_node_idx(buffer_set, (struct buffer_set_node_s*) first);
+    const buffer_set_size_t size = buffer_set->size;
+    if (_unshare(buffer_set) != 0)
+        return 0;
+    // a few values are erased one by one in O(k log n)
+    if (((size_t) count * 16) < size)
+        return _erase_nodes(buffer_set, first_idx, count);
+
+    buffer_set_size_t * nodes = _alloc(buffer_set, size * sizeof(buffer_set_size_t));
+    if (nodes == NULL)
+        return _erase_nodes(buffer_set, first_idx, count);
+
+    buffer_set_size_t kept = 0;
+    buffer_set_size_t erased = 0;
+    buffer_set_cursor_t cursor;
+    for (void * value=buffer_set_cursor_first(buffer_set, &cursor); value; value=buffer_set_cursor_next(buffer_set, &cursor))
+    {
+        const buffer_set_size_t idx = cursor.stack[cursor.depth - 1];
+        if (idx == first_idx)
+            erased = count;
+        if (erased)
+            nodes[size - erased--] = idx;
+        else
+            nodes[kept++] = idx;
+    }
+
+    _rebuild(buffer_set, nodes, kept);
+    _free(buffer_set, nodes, size * sizeof(buffer_set_size_t));
+    return count;
+}
+
+buffer_set_size_t buffer_set_erase_if(
+    buffer_set_t * buffer_set,
+    int (*pred)(const void * value, void * ctx),
+    void * ctx
+) {
+    const buffer_set_size_t size = buffer_set->size;
+    if ((size == 0) || (_unshare(buffer_set) != 0))
+        return 0;
+
+    buffer_set_size_t * nodes = _alloc(buffer_set, size * sizeof(buffer_set_size_t));
+    if (nodes == NULL)
+    {
+        // no memory for the rebuild, erase the values one by one
+        buffer_set_size_t count = 0;
+        buffer_set_iterator_t * it = buffer_set_begin(buffer_set);
+        buffer_set_iterator_t * it_end = buffer_set_end(buffer_set);
+        while (it != it_end)
+        {
+            buffer_set_iterator_t * next = buffer_set_iterator_next(buffer_set, it);
+            if (pred(buffer_set_get_at(buffer_set, it), ctx))
+            {
+                buffer_set_erase_at(buffer_set, it);
+                count++;
+            }
+            it = next;
+        }
+        return count;
+    }
+
+    buffer_set_size_t kept = 0;
+    buffer_set_size_t erased = 0;
+    buffer_set_cursor_t cursor;
+    for (void * value=buffer_set_cursor_first(buffer_set, &cursor); value; value=buffer_set_cursor_next(buffer_set, &cursor))
+    {
+        const buffer_set_size_t idx = cursor.stack[cursor.depth - 1];
+        if (pred(value, ctx))
+            nodes[size - ++erased] = idx;
+        else
+            nodes[kept++] = idx;
+    }
+
+    if (erased)
+        _rebuild(buffer_set, nodes, kept);
+    _free(buffer_set, nodes, size * sizeof(buffer_set_size_t));
+    return erased;
+}
+
+static int _reserve(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t count
+) {
+    // Grows the buffer if the set has less than count free nodes,
+    // the new nodes are added to the free list.
+    const buffer_set_size_t capacity = buffer_set->capacity;
+    const size_t free_count = capacity ? ((size_t) capacity - buffer_set->size - 1) : 0;
+    if (free_count >= count)
+        return 0;
+
+    const size_t min_capacity = ((size_t) buffer_set->size + count + 1);
+    if (min_capacity > MAX_CAPACITY)
+        return -1;
+    buffer_set_size_t new_capacity = _calculate_new_capacity(buffer_set, capacity);
+    if (new_capacity < min_capacity)
+        new_capacity = (buffer_set_size_t) min_capacity;
+
+    const size_t buffer_size = _get_buffer_size(buffer_set, new_capacity);
+    void * buffer = buffer_size ? _grow_buffer(buffer_set, new_capacity, buffer_size) : NULL;
+    if (buffer == NULL)
+        return -1;
+
+    _set_buffer(buffer_set, buffer, new_capacity);
+    _rehash(buffer_set);
+
+    // the node 0 is not used, the nodes of a set with zero capacity start from 1
+    const buffer_set_size_t first_idx = (capacity ? capacity : 1);
+    const buffer_set_size_t free_list = _make_free_list(buffer, buffer_set->node_size, first_idx, new_capacity - first_idx);
+    _get_free_node(buffer_set, new_capacity - 1)->next = buffer_set->free_list;
+    buffer_set->free_list = free_list;
+    return 0;
+}
+
+static int _get_height(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    // follows the higher subtree down to a leaf, O(log n)
+    int height = 0;
+    while (idx != NULL_IDX)
+    {
+        struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+        height++;
+        idx = (node->balance < 0) ? node->left : node->right;
+    }
+    return height;
+}
+
+static void _join(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t left_idx,
+    int left_height,
+    buffer_set_size_t idx,
+    buffer_set_size_t right_idx,
+    int right_height
+) {
+    // Joins the trees with the node idx holding a value between them.
+    // The node is linked at the spine of the higher tree where the subtree
+    // height is close to the height of the lower tree, the subtree grows
+    // by one there and the tree is rebalanced up to the root like on insert.
+    // The root of the joined tree is stored as the root of the set.
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+    buffer_set_size_t parent_idx = NULL_IDX;
+    if (left_height > (right_height + 1))
+    {
+        buffer_set->root = left_idx;
+        while (left_height > (right_height + 1))
+        {
+            struct buffer_set_node_s * spine_node = _get_node(buffer_set, left_idx);
+            left_height -= ((spine_node->balance < 0) ? 2 : 1);
+            parent_idx = left_idx;
+            left_idx = spine_node->right;
+        }
+        _get_node(buffer_set, parent_idx)->right = idx;
+    }
+    else if (right_height > (left_height + 1))
+    {
+        buffer_set->root = right_idx;
+        while (right_height > (left_height + 1))
+        {
+            struct buffer_set_node_s * spine_node = _get_node(buffer_set, right_idx);
+            right_height -= ((spine_node->balance > 0) ? 2 : 1);
+            parent_idx = right_idx;
+            right_idx = spine_node->left;
+        }
+        _get_node(buffer_set, parent_idx)->left = idx;
+    }
+    else
+        buffer_set->root = idx;
+
+    node->parent = parent_idx;
+    node->left = left_idx;
+    node->right = right_idx;
+    node->balance = (int8_t) (right_height - left_height);
+    // parent of the node 0 can be written
+    _get_node(buffer_set, left_idx)->parent = idx;
+    _get_node(buffer_set, right_idx)->parent = idx;
+    _update_node(buffer_set, idx);
+    if (parent_idx == NULL_IDX)
+        return;
+    _update_path(buffer_set, parent_idx);
+
+    buffer_set_size_t from_idx = idx;
+    idx = parent_idx;
+    while (idx != NULL_IDX)
+    {
+        node = _get_node(buffer_set, idx);
+        node->balance += ((node->left == from_idx) ? -1 : 1);
+        if (node->balance == 0)
+            break;
+        parent_idx = node->parent;
+        if ((node->balance == -2) || (node->balance == 2))
+        {
+            const struct balance_result_s balance_result = (node->balance == -2)
+                ? _balance_left(buffer_set, idx, node)
+                : _balance_right(buffer_set, idx, node);
+            _replace_child(buffer_set, parent_idx, idx, balance_result.idx);
+            // the subtree is lower after the rotation unless the linked node was balanced
+            if (!balance_result.height_changed)
+                break;
+            idx = balance_result.idx;
+        }
+        from_idx = idx;
+        idx = parent_idx;
+    }
+}
+
+int buffer_set_join(buffer_set_t * a, buffer_set_t * b)
+{
+    assert(_is_writable(a));
+    if ((a->compar != b->compar) || (a->value_size != b->value_size) || (a->move != b->move) || (a == b))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const buffer_set_size_t count = b->size;
+    if (count == 0)
+        return 0;
+    if ((a->size > 0) && (a->compar(buffer_set_last(a), buffer_set_get_at(b, buffer_set_begin(b)), a->thunk) >= 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const size_t nodes_size = (count * sizeof(buffer_set_size_t));
+    buffer_set_size_t * nodes = _alloc(a, nodes_size);
+    if ((nodes == NULL) || (_unshare(a) != 0) || (_reserve(a, count) != 0))
+    {
+        _free(a, nodes, nodes_size);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Values of b are copied into free nodes of a (or relocated with
+    // the move function), the first one is the node joining the trees,
+    // the others are linked into a tree.
+    const size_t value_size = a->value_size;
+    buffer_set_size_t pos = 0;
+    buffer_set_cursor_t cursor;
+    for (void * value=buffer_set_cursor_first(b, &cursor); value; value=buffer_set_cursor_next(b, &cursor))
+    {
+        const buffer_set_size_t idx = a->free_list;
+        a->free_list = _get_free_node(a, idx)->next;
+        void * dst_value = _get_value(a, idx);
+        if (a->move)
+            a->move(dst_value, value, a->thunk);
+        else
+            memcpy(dst_value, value, value_size);
+        if (a->hash_index)
+            _hash_insert(a, dst_value, idx);
+        nodes[pos++] = idx;
+    }
+    // relocated values do not belong to b anymore
+    if (b->move)
+        buffer_set_clear(b);
+
+    int right_height;
+    const buffer_set_size_t right_idx = _build_balanced_nodes(a, nodes + 1, count - 1, NULL_IDX, &right_height);
+    const buffer_set_size_t left_idx = a->root;
+    _join(a, left_idx, _get_height(a, left_idx), nodes[0], right_idx, right_height);
+    a->size += count;
+    _free(a, nodes, nodes_size);
+    return 0;
+}
+
+static buffer_set_size_t _join_trees(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t left_idx,
+    int left_height,
+    buffer_set_size_t idx,
+    buffer_set_size_t right_idx,
+    int right_height,
+    int * height
+) {
+    _join(buffer_set, left_idx, left_height, idx, right_idx, right_height);
+    const buffer_set_size_t root = buffer_set->root;
+    *height = _get_height(buffer_set, root);
+    return root;
+}
+
+static void _split_tree(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx,
+    int height,
+    const void * key,
+    buffer_set_size_t * lo_idx,
+    int * lo_height,
+    buffer_set_size_t * hi_idx,
+    int * hi_height
+) {
+    // Splits the detached subtree of the given height into the trees
+    // of the values less than the key and of the others. The subtrees
+    // cut off along the search path are joined back with the nodes
+    // of the path, O(log n) joins of O(log n) each.
+    if (idx == NULL_IDX)
+    {
+        *lo_idx = NULL_IDX;
+        *lo_height = 0;
+        *hi_idx = NULL_IDX;
+        *hi_height = 0;
+        return;
+    }
+
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+    const buffer_set_size_t left_idx = node->left;
+    const buffer_set_size_t right_idx = node->right;
+    const int left_height = (height - ((node->balance > 0) ? 2 : 1));
+    const int right_height = (height - ((node->balance < 0) ? 2 : 1));
+    // parent of the node 0 can be written
+    _get_node(buffer_set, left_idx)->parent = NULL_IDX;
+    _get_node(buffer_set, right_idx)->parent = NULL_IDX;
+
+    buffer_set_size_t mid_idx;
+    int mid_height;
+    if (buffer_set->compar(key, _get_value(buffer_set, idx), buffer_set->thunk) <= 0)
+    {
+        _split_tree(buffer_set, left_idx, left_height, key, lo_idx, lo_height, &mid_idx, &mid_height);
+        *hi_idx = _join_trees(buffer_set, mid_idx, mid_height, idx, right_idx, right_height, hi_height);
+    }
+    else
+    {
+        _split_tree(buffer_set, right_idx, right_height, key, &mid_idx, &mid_height, hi_idx, hi_height);
+        *lo_idx = _join_trees(buffer_set, left_idx, left_height, idx, mid_idx, mid_height, lo_height);
+    }
+}
+
+static void _move_values(
+    struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx,
+    struct buffer_set_s * dst,
+    buffer_set_size_t * count
+) {
+    // Moves the values of the detached subtree in ascending order
+    // into the consecutive nodes of the empty set dst,
+    // the nodes are returned to the free list.
+    struct buffer_set_node_s * node = _get_node(buffer_set, idx);
+    const buffer_set_size_t left_idx = node->left;
+    const buffer_set_size_t right_idx = node->right;
+    if (left_idx != NULL_IDX)
+        _move_values(buffer_set, left_idx, dst, count);
+
+    if (buffer_set->hash_index)
+        _hash_remove(buffer_set, idx);
+    void * value = _get_value(buffer_set, idx);
+    void * dst_value = _get_value(dst, ++*count);
+    if (buffer_set->move)
+        buffer_set->move(dst_value, value, buffer_set->thunk);
+    else
+        memcpy(dst_value, value, buffer_set->value_size);
+    _get_free_node(buffer_set, idx)->next = buffer_set->free_list;
+    buffer_set->free_list = idx;
+
+    if (right_idx != NULL_IDX)
+        _move_values(buffer_set, right_idx, dst, count);
+}
+
+int buffer_set_split(
+    buffer_set_t * buffer_set,
+    const void * key,
+    buffer_set_t ** hi
+) {
+    assert(_is_writable(buffer_set));
+    buffer_set_size_t hi_size = 0;
+    buffer_set_iterator_t * it = buffer_set_lower_bound(buffer_set, key);
+    buffer_set_iterator_t * it_end = buffer_set_end(buffer_set);
+    for (; it != it_end; it=buffer_set_iterator_next(buffer_set, it))
+        hi_size++;
+
+    buffer_set_t * hi_set = _create_like(buffer_set, hi_size);
+    if (hi_set == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (_unshare(buffer_set) != 0)
+    {
+        buffer_set_destroy(hi_set);
+        return -1;
+    }
+
+    buffer_set_write_begin(hi_set);
+    if (hi_size > 0)
+    {
+        buffer_set_size_t lo_idx;
+        buffer_set_size_t hi_idx;
+        int lo_height;
+        int hi_height;
+        const buffer_set_size_t root = buffer_set->root;
+        _split_tree(buffer_set, root, _get_height(buffer_set, root), key, &lo_idx, &lo_height, &hi_idx, &hi_height);
+
+        buffer_set_size_t count = 0;
+        _move_values(buffer_set, hi_idx, hi_set, &count);
+        assert(count == hi_size);
+        buffer_set->root = lo_idx;
+        buffer_set->size -= hi_size;
+        _link_sorted(hi_set, hi_size);
+    }
+    buffer_set_write_end(hi_set);
+
+    *hi = hi_set;
+    return 0;
+}
+
+int buffer_set_optimize_layout(buffer_set_t * buffer_set)
+{
+    assert(_is_writable(buffer_set));
+    const buffer_set_size_t size = buffer_set->size;
+    if (size == 0)
+        return 0;
+
+    const buffer_set_size_t capacity = buffer_set->capacity;
+    const size_t buffer_size = _get_buffer_size(buffer_set, capacity);
+    void * buffer = _alloc(buffer_set, buffer_size);
+    if (buffer == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    void * old_buffer = buffer_set->buffer;
+    void * old_values = buffer_set->values;
+    const size_t node_size = buffer_set->node_size;
+    const size_t value_stride = buffer_set->value_stride;
+    char * values = _get_values(buffer_set, buffer, capacity);
+
+    // The new buffer itself is used as the queue of the breadth first traversal:
+    // the node at the new index k is the k-th node of the traversal,
+    // until it is processed its left link holds the index of the node
+    // in the old buffer.
+    struct buffer_set_node_s * node = (struct buffer_set_node_s*) (((char*)buffer) + node_size);
+    node->parent = NULL_IDX;
+    node->left = buffer_set->root;
+    buffer_set_size_t tail = 1;
+    for (buffer_set_size_t idx=1; idx<=size; idx++)
+    {
+        node = (struct buffer_set_node_s*) (((char*)buffer) + (node_size * idx));
+        const buffer_set_size_t old_idx = node->left;
+        const buffer_set_size_t parent_idx = node->parent;
+        const struct buffer_set_node_s * old_node =
+            (const struct buffer_set_node_s*) (((char*)old_buffer) + (node_size * old_idx));
+
+        // keeps the balance and the augmented data, subtrees do not change
+        memcpy(node, old_node, buffer_set->header_size);
+        node->parent = parent_idx;
+        if (old_node->left != NULL_IDX)
+        {
+            struct buffer_set_node_s * child = (struct buffer_set_node_s*) (((char*)buffer) + (node_size * ++tail));
+            child->parent = idx;
+            child->left = old_node->left;
+            node->left = tail;
+        }
+        if (old_node->right != NULL_IDX)
+        {
+            struct buffer_set_node_s * child = (struct buffer_set_node_s*) (((char*)buffer) + (node_size * ++tail));
+            child->parent = idx;
+            child->left = old_node->right;
+            node->right = tail;
+        }
+
+        void * value = values + (value_stride * idx);
+        void * old_value = ((char*)old_values) + (value_stride * old_idx);
+        if (buffer_set->move)
+            buffer_set->move(value, old_value, buffer_set->thunk);
+        else
+            memcpy(value, old_value, buffer_set->value_size);
+    }
+    assert(tail == size);
+
+    _free_buffer(buffer_set, old_buffer, buffer_size);
+    _set_buffer(buffer_set, buffer, capacity);
+    buffer_set->root = 1;
+    buffer_set->free_list = _make_free_list(buffer, node_size, (size + 1), (capacity - size - 1));
+    _rehash(buffer_set);
+    return 0;
+}
+
+void buffer_set_clear(buffer_set_t * buffer_set)
+{
+    assert(_is_writable(buffer_set));
+    if (buffer_set->snapshot && (_atomic_add(&buffer_set->snapshot->refcount, 0) > 1))
+    {
+        // The buffer is left to the snapshot instead of copying it,
+        // the set gets an empty buffer of the same capacity.
+        const buffer_set_size_t capacity = buffer_set->capacity;
+        void * buffer = _alloc(buffer_set, _get_buffer_size(buffer_set, capacity));
+        struct buffer_set_snapshot_s * snapshot = buffer_set->snapshot;
+        buffer_set->snapshot = NULL;
+        buffer_set_snapshot_release(snapshot);
+        buffer_set->root = NULL_IDX;
+        buffer_set->size = 0;
+        if (buffer == NULL)
+        {
+            // no memory, the buffer is allocated again on the next insert
+            _set_buffer(buffer_set, NULL, 0);
+            buffer_set->free_list = NULL_IDX;
+            return;
+        }
+        _set_buffer(buffer_set, buffer, capacity);
+        buffer_set->free_list = _make_free_list(buffer, buffer_set->node_size, 1, (capacity - 1));
+        _rehash(buffer_set);
+        return;
+    }
+
+    // can not fail, the snapshot is released already
+    _unshare(buffer_set);
+    const buffer_set_size_t root = buffer_set->root;
+    if (root != NULL_IDX)
+    {
+        buffer_set->free_list = _buffer_set_clear(buffer_set, buffer_set->free_list, root);
+        buffer_set->root = NULL_IDX;
+        buffer_set->size = 0;
+        _rehash(buffer_set);
+    }
+}
+
+void buffer_set_destroy(buffer_set_t * buffer_set)
+{
+    const buffer_set_allocator_t allocator = buffer_set->allocator;
+    for (size_t idx=0; idx<buffer_set->retired_count; idx++)
+        _free(buffer_set, buffer_set->retired[idx].ptr, buffer_set->retired[idx].size);
+    _free(buffer_set, buffer_set->retired, buffer_set->retired_capacity * sizeof(struct buffer_set_retired_s));
+    _free(buffer_set, buffer_set->readers_alloc, _get_readers_alloc_size(buffer_set->max_readers));
+    if (buffer_set->snapshot)
+        buffer_set_snapshot_release(buffer_set->snapshot);
+    else
+        _free(buffer_set, buffer_set->buffer, _get_buffer_size(buffer_set, buffer_set->capacity));
+    allocator.free(buffer_set, sizeof(struct buffer_set_s), allocator.ctx);
+}
+
+int buffer_set_write_begin(buffer_set_t * buffer_set)
+{
+    if (_unshare(buffer_set) != 0)
+        return -1;
+    if (!(buffer_set->flags & BUFFER_SET_CONCURRENT_READS))
+        return 0;
+    if (buffer_set->write_depth++ == 0)
+    {
+        // the odd counter should be visible before any modification
+        _store_release_uint(&buffer_set->seq, buffer_set->seq + 1);
+        _memory_fence();
+    }
+    return 0;
+}
+
+void buffer_set_write_end(buffer_set_t * buffer_set)
+{
+    if (!(buffer_set->flags & BUFFER_SET_CONCURRENT_READS))
+        return;
+    assert(buffer_set->write_depth > 0);
+    if (--buffer_set->write_depth == 0)
+    {
+        _store_release_uint(&buffer_set->seq, buffer_set->seq + 1);
+        _reclaim(buffer_set);
+    }
+}
+
+int buffer_set_reader_register(buffer_set_t * buffer_set)
+{
+    if (!(buffer_set->flags & BUFFER_SET_CONCURRENT_READS))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (unsigned int idx=0; idx<buffer_set->max_readers; idx++)
+    {
+        if (_claim(&buffer_set->readers[idx].used))
+            return (int) idx;
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+void buffer_set_reader_unregister(buffer_set_t * buffer_set, int reader)
+{
+    struct buffer_set_reader_slot_s * slot = &buffer_set->readers[reader];
+    _store_release_size(&slot->epoch, 0);
+    _memory_fence();
+    slot->used = 0;
+}
+
+int buffer_set_reader_get(
+    buffer_set_t * buffer_set,
+    int reader,
+    const void * value,
+    void * out
+) {
+    // Sequence lock read side. The layout of the set is read between two
+    // reads of the counter, so it is consistent if the counter did not change.
+    // The nodes are then walked while the writer can modify them, the indices
+    // are checked against the capacity and the depth is limited, so a torn
+    // read can not leave the buffer, which is kept by the reader epoch.
+    // The result is valid only if the counter still did not change.
+    struct buffer_set_reader_slot_s * slot = &buffer_set->readers[reader];
+    const volatile struct buffer_set_s * shared = buffer_set;
+    const size_t node_size = buffer_set->node_size;
+    const size_t value_stride = buffer_set->value_stride;
+    for (;;)
+    {
+        _store_release_size(&slot->epoch, _load_acquire_size(&buffer_set->epoch));
+        _memory_fence();
+
+        const unsigned int seq = _load_acquire_uint(&buffer_set->seq);
+        if (seq & 1)
+        {
+            // the writer is inside a write section
+            _store_release_size(&slot->epoch, 0);
+            _cpu_pause();
+            continue;
+        }
+
+        const char * buffer = shared->buffer;
+        const char * values = shared->values;
+        const buffer_set_size_t capacity = shared->capacity;
+        buffer_set_size_t idx = shared->root;
+        _memory_fence();
+        if (_load_acquire_uint(&buffer_set->seq) != seq)
+        {
+            _store_release_size(&slot->epoch, 0);
+            _cpu_pause();
+            continue;
+        }
+
+        int found = 0;
+        for (unsigned int depth=0; (idx != NULL_IDX) && (idx < capacity) && (depth < BUFFER_SET_CURSOR_DEPTH); depth++)
+        {
+            const char * node_value = values + (value_stride * idx);
+            const int cmp = buffer_set->compar(value, node_value, buffer_set->thunk);
+            if (cmp == 0)
+            {
+                memcpy(out, node_value, buffer_set->value_size);
+                found = 1;
+                break;
+            }
+            const volatile struct buffer_set_node_s * node =
+                (const volatile struct buffer_set_node_s*) (buffer + (node_size * idx));
+            idx = (cmp > 0) ? node->right : node->left;
+        }
+
+        _memory_fence();
+        const unsigned int end_seq = _load_acquire_uint(&buffer_set->seq);
+        _store_release_size(&slot->epoch, 0);
+        if (end_seq == seq)
+            return found;
+        _cpu_pause();
+    }
+}
+
+buffer_set_snapshot_t * buffer_set_snapshot(buffer_set_t * buffer_set)
+{
+    if (buffer_set->move || (buffer_set->flags & (BUFFER_SET_CONCURRENT_READS | SNAPSHOT_VIEW)))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // the set did not change since the last snapshot
+    if (buffer_set->snapshot)
+    {
+        buffer_set_snapshot_retain(buffer_set->snapshot);
+        return buffer_set->snapshot;
+    }
+
+    struct buffer_set_snapshot_s * snapshot = _alloc(buffer_set, sizeof(struct buffer_set_snapshot_s));
+    if (snapshot == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    snapshot->set = *buffer_set;
+    snapshot->set.flags |= SNAPSHOT_VIEW;
+    snapshot->set.snapshot = NULL;
+    snapshot->buffer_size = buffer_set->buffer ? _get_buffer_size(buffer_set, buffer_set->capacity) : 0;
+    // one reference for the caller and one for the set sharing the buffer
+    snapshot->refcount = 2;
+    buffer_set->snapshot = snapshot;
+    return snapshot;
+}
+
+buffer_set_t * buffer_set_snapshot_get_set(buffer_set_snapshot_t * snapshot)
+{
+    return &snapshot->set;
+}
+
+void buffer_set_snapshot_retain(buffer_set_snapshot_t * snapshot)
+{
+    _atomic_add(&snapshot->refcount, 1);
+}
+
+void buffer_set_snapshot_release(buffer_set_snapshot_t * snapshot)
+{
+    if (_atomic_add(&snapshot->refcount, -1) != 0)
+        return;
+    const buffer_set_allocator_t allocator = snapshot->set.allocator;
+    if (snapshot->set.buffer)
+        allocator.free(snapshot->set.buffer, snapshot->buffer_size, allocator.ctx);
+    allocator.free(snapshot, sizeof(struct buffer_set_snapshot_s), allocator.ctx);
+}
+
+static inline size_t _get_frozen_alloc_size(size_t value_stride, buffer_set_size_t size)
+{
+    // position 0 is not used, which keeps the index calculations simple
+    return _round(sizeof(struct buffer_set_frozen_s)) + (value_stride * ((size_t) size + 1));
+}
+
+static void _freeze_fill(
+    struct buffer_set_s * buffer_set,
+    buffer_set_frozen_t * frozen,
+    size_t k,
+    buffer_set_cursor_t * cursor,
+    void ** value
+) {
+    // Visits the positions in order of the values, which is the in-order
+    // traversal of the implicit tree, and takes the next value of the set.
+    if (k > frozen->size)
+        return;
+    _freeze_fill(buffer_set, frozen, (2 * k), cursor, value);
+    memcpy(frozen->values + (frozen->value_stride * k), *value, frozen->value_size);
+    *value = buffer_set_cursor_next(buffer_set, cursor);
+    _freeze_fill(buffer_set, frozen, (2 * k + 1), cursor, value);
+}
+
+buffer_set_frozen_t * buffer_set_freeze(buffer_set_t * buffer_set)
+{
+    const size_t value_stride = _round(buffer_set->value_size);
+    const size_t alloc_size = _get_frozen_alloc_size(value_stride, buffer_set->size);
+    buffer_set_frozen_t * frozen = _alloc(buffer_set, alloc_size);
+    if (frozen == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    frozen->value_size = buffer_set->value_size;
+    frozen->value_stride = value_stride;
+    frozen->compar = buffer_set->compar;
+    frozen->thunk = buffer_set->thunk;
+    frozen->allocator = buffer_set->allocator;
+    frozen->size = buffer_set->size;
+    frozen->values = ((char*) frozen) + _round(sizeof(struct buffer_set_frozen_s));
+
+    buffer_set_cursor_t cursor;
+    void * value = buffer_set_cursor_first(buffer_set, &cursor);
+    _freeze_fill(buffer_set, frozen, 1, &cursor, &value);
+    assert(value == NULL);
+    return frozen;
+}
+
+buffer_set_size_t buffer_set_frozen_get_size(const buffer_set_frozen_t * frozen)
+{
+    return frozen->size;
+}
+
+static inline size_t _frozen_lower_bound(
+    const buffer_set_frozen_t * frozen,
+    const void * value
+) {
+    // Returns the position of the first value not less than the given one, 0 if none.
+    const char * values = frozen->values;
+    const size_t value_stride = frozen->value_stride;
+    const size_t size = frozen->size;
+    size_t k = 1;
+    while (k <= size)
+    {
+        // 16 nodes four levels below are stored contiguously
+        PREFETCH(values + (value_stride * 16 * k));
+        const int cmp = frozen->compar(values + (value_stride * k), value, frozen->thunk);
+        k = (2 * k) + (cmp < 0);
+    }
+    // Every step to the right appended 1 to k, the position is the node
+    // where the descent went left the last time: drop the trailing ones
+    // and the zero before them.
+#if defined(__GNUC__) || defined(__clang__)
+    k >>= (__builtin_ctzll(~(unsigned long long) k) + 1);
+#else
+    while (k & 1)
+        k >>= 1;
+    k >>= 1;
+#endif
+    return k;
+}
+
+const void * buffer_set_frozen_get(
+    const buffer_set_frozen_t * frozen,
+    const void * value
+) {
+    const size_t k = _frozen_lower_bound(frozen, value);
+    if (k == 0)
+        return NULL;
+    const char * ptr = frozen->values + (frozen->value_stride * k);
+    return (frozen->compar(value, ptr, frozen->thunk) == 0) ? ptr : NULL;
+}
+
+const void * buffer_set_frozen_lower_bound(
+    const buffer_set_frozen_t * frozen,
+    const void * value
+) {
+    const size_t k = _frozen_lower_bound(frozen, value);
+    return k ? (frozen->values + (frozen->value_stride * k)) : NULL;
+}
+
+void buffer_set_frozen_destroy(buffer_set_frozen_t * frozen)
 {
-    free(buffer_set->buffer);
-    free(buffer_set);
+    const buffer_set_allocator_t allocator = frozen->allocator;
+    allocator.free(frozen, _get_frozen_alloc_size(frozen->value_stride, frozen->size), allocator.ctx);
 }
@@ -0,0 +1,353 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include "buffer_set_internal.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+// Keys of a block occupy one cache line
+#define BLOCK_BYTES 64
+#define KEYS32 (BLOCK_BYTES / sizeof(int32_t))
+#define KEYS64 (BLOCK_BYTES / sizeof(int64_t))
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+// Kernels are compiled for the instruction sets with the target attribute
+// and selected at runtime, so the library does not require the compiler flags.
+#define X86_DISPATCH 1
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+// SSE2 is always available on the x86 targets of the MSVC
+#define X86_SSE2 1
+#include <emmintrin.h>
+#endif
+
+struct buffer_set_int_index_s
+{
+    int key_type;
+    size_t key_offset;
+    size_t value_size;
+    size_t value_stride;
+    // number of blocks and number of keys in a block
+    size_t blocks;
+    size_t block_keys;
+    // whether the largest possible key is in the index,
+    // the same key is used for padding the last blocks
+    int has_max_key;
+    // Returns the number of keys in the block less than the given one,
+    // keys of unsigned types are biased to signed ones.
+    unsigned int (*rank32)(const int32_t * keys, int32_t key);
+    unsigned int (*rank64)(const int64_t * keys, int64_t key);
+    void * keys;
+    // value of the key at the position i is located at (values + i * value_stride)
+    char * values;
+    buffer_set_allocator_t allocator;
+    size_t alloc_size;
+};
+
+static inline size_t _round(size_t v)
+{
+    const size_t c = (sizeof(void*) - 1);
+    v += c;
+    return (v - (v & c));
+}
+
+static inline unsigned int _count_bits(unsigned int mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int) __builtin_popcount(mask);
+#else
+    unsigned int count = 0;
+    for (; mask; mask &= (mask - 1))
+        count++;
+    return count;
+#endif
+}
+
+static unsigned int _rank32_scalar(const int32_t * keys, int32_t key)
+{
+    unsigned int rank = 0;
+    for (size_t idx=0; idx<KEYS32; idx++)
+        rank += (keys[idx] < key);
+    return rank;
+}
+
+static unsigned int _rank64_scalar(const int64_t * keys, int64_t key)
+{
+    unsigned int rank = 0;
+    for (size_t idx=0; idx<KEYS64; idx++)
+        rank += (keys[idx] < key);
+    return rank;
+}
+
+#if defined(X86_DISPATCH) || defined(X86_SSE2)
+
+#if defined(X86_DISPATCH)
+__attribute__((target("sse2")))
+#endif
+static unsigned int _rank32_sse2(const int32_t * keys, int32_t key)
+{
+    const __m128i k = _mm_set1_epi32(key);
+    const __m128i * block = (const __m128i*) keys;
+    unsigned int mask = 0;
+    for (int idx=0; idx<4; idx++)
+    {
+        const __m128i lt = _mm_cmpgt_epi32(k, _mm_load_si128(block + idx));
+        mask |= ((unsigned int) _mm_movemask_ps(_mm_castsi128_ps(lt)) << (idx * 4));
+    }
+    return _count_bits(mask);
+}
+
+#endif /* X86_DISPATCH || X86_SSE2 */
+
+#if defined(X86_DISPATCH)
+
+__attribute__((target("avx2")))
+static unsigned int _rank32_avx2(const int32_t * keys, int32_t key)
+{
+    const __m256i k = _mm256_set1_epi32(key);
+    const __m256i * block = (const __m256i*) keys;
+    const __m256i lt0 = _mm256_cmpgt_epi32(k, _mm256_load_si256(block));
+    const __m256i lt1 = _mm256_cmpgt_epi32(k, _mm256_load_si256(block + 1));
+    const unsigned int mask =
+        ((unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(lt0))) |
+        ((unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(lt1)) << 8);
+    return _count_bits(mask);
+}
+
+__attribute__((target("sse4.2")))
+static unsigned int _rank64_sse42(const int64_t * keys, int64_t key)
+{
+    const __m128i k = _mm_set1_epi64x(key);
+    const __m128i * block = (const __m128i*) keys;
+    unsigned int mask = 0;
+    for (int idx=0; idx<4; idx++)
+    {
+        const __m128i lt = _mm_cmpgt_epi64(k, _mm_load_si128(block + idx));
+        mask |= ((unsigned int) _mm_movemask_pd(_mm_castsi128_pd(lt)) << (idx * 2));
+    }
+    return _count_bits(mask);
+}
+
+__attribute__((target("avx2")))
+static unsigned int _rank64_avx2(const int64_t * keys, int64_t key)
+{
+    const __m256i k = _mm256_set1_epi64x(key);
+    const __m256i * block = (const __m256i*) keys;
+    const __m256i lt0 = _mm256_cmpgt_epi64(k, _mm256_load_si256(block));
+    const __m256i lt1 = _mm256_cmpgt_epi64(k, _mm256_load_si256(block + 1));
+    const unsigned int mask =
+        ((unsigned int) _mm256_movemask_pd(_mm256_castsi256_pd(lt0))) |
+        ((unsigned int) _mm256_movemask_pd(_mm256_castsi256_pd(lt1)) << 4);
+    return _count_bits(mask);
+}
+
+#endif /* X86_DISPATCH */
+
+static void _select_kernels(struct buffer_set_int_index_s * index)
+{
+    index->rank32 = &_rank32_scalar;
+    index->rank64 = &_rank64_scalar;
+#if defined(X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        index->rank32 = &_rank32_avx2;
+        index->rank64 = &_rank64_avx2;
+    }
+    else
+    {
+        if (__builtin_cpu_supports("sse2"))
+            index->rank32 = &_rank32_sse2;
+        if (__builtin_cpu_supports("sse4.2"))
+            index->rank64 = &_rank64_sse42;
+    }
+#elif defined(X86_SSE2)
+    index->rank32 = &_rank32_sse2;
+#endif
+}
+
+static inline int64_t _read_key(const struct buffer_set_int_index_s * index, const void * ptr)
+{
+    // Reads the key biasing unsigned keys, so the signed comparison
+    // of the biased keys gives the unsigned order.
+    switch (index->key_type)
+    {
+    case BUFFER_SET_KEY_INT32:
+        {
+            int32_t key;
+            memcpy(&key, ptr, sizeof(key));
+            return key;
+        }
+    case BUFFER_SET_KEY_UINT32:
+        {
+            uint32_t key;
+            memcpy(&key, ptr, sizeof(key));
+            return (int32_t) (key ^ UINT32_C(0x80000000));
+        }
+    default:
+        {
+            uint64_t key;
+            memcpy(&key, ptr, sizeof(key));
+            return (int64_t) (key ^ UINT64_C(0x8000000000000000));
+        }
+    }
+}
+
+static inline size_t _get_child(const struct buffer_set_int_index_s * index, size_t block, size_t idx)
+{
+    return (block * (index->block_keys + 1) + idx + 1);
+}
+
+static void _build(
+    struct buffer_set_int_index_s * index,
+    buffer_set_t * buffer_set,
+    size_t block,
+    buffer_set_cursor_t * cursor,
+    void ** value
+) {
+    // In-order traversal of the implicit tree takes the values
+    // of the set in the ascending order, positions remaining
+    // after the last value are padded with the largest key.
+    if (block >= index->blocks)
+        return;
+    for (size_t idx=0; idx<index->block_keys; idx++)
+    {
+        _build(index, buffer_set, _get_child(index, block, idx), cursor, value);
+        const size_t pos = (block * index->block_keys + idx);
+        const int64_t key = *value
+            ? _read_key(index, ((const char*) *value) + index->key_offset)
+            : ((index->key_type == BUFFER_SET_KEY_UINT64) ? INT64_MAX : INT32_MAX);
+        if (index->key_type == BUFFER_SET_KEY_UINT64)
+            ((int64_t*) index->keys)[pos] = key;
+        else
+            ((int32_t*) index->keys)[pos] = (int32_t) key;
+        if (*value)
+        {
+            memcpy(index->values + (index->value_stride * pos), *value, index->value_size);
+            *value = buffer_set_cursor_next(buffer_set, cursor);
+            if (*value == NULL)
+                index->has_max_key = (key == ((index->key_type == BUFFER_SET_KEY_UINT64) ? INT64_MAX : INT32_MAX));
+        }
+    }
+    _build(index, buffer_set, _get_child(index, block, index->block_keys), cursor, value);
+}
+
+buffer_set_int_index_t * buffer_set_int_index_create(
+    buffer_set_t * buffer_set,
+    int key_type,
+    size_t key_offset
+) {
+    size_t key_size;
+    if ((key_type == BUFFER_SET_KEY_INT32) || (key_type == BUFFER_SET_KEY_UINT32))
+        key_size = sizeof(int32_t);
+    else if (key_type == BUFFER_SET_KEY_UINT64)
+        key_size = sizeof(int64_t);
+    else
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((key_offset > buffer_set->value_size) || ((buffer_set->value_size - key_offset) < key_size))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    const size_t block_keys = (BLOCK_BYTES / key_size);
+    const size_t blocks = ((buffer_set->size + block_keys - 1) / block_keys);
+    const size_t value_stride = _round(buffer_set->value_size);
+    const size_t keys_offset = _round(sizeof(struct buffer_set_int_index_s));
+    // keys are aligned to the block size for the aligned vector loads
+    const size_t alloc_size = keys_offset + (BLOCK_BYTES - 1) + (blocks * BLOCK_BYTES) +
+        (blocks * block_keys * value_stride);
+
+    struct buffer_set_int_index_s * index = buffer_set->allocator.alloc(alloc_size, buffer_set->allocator.ctx);
+    if (index == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    index->key_type = key_type;
+    index->key_offset = key_offset;
+    index->value_size = buffer_set->value_size;
+    index->value_stride = value_stride;
+    index->blocks = blocks;
+    index->block_keys = block_keys;
+    index->has_max_key = 0;
+    _select_kernels(index);
+    uintptr_t keys = (uintptr_t) (((char*) index) + keys_offset);
+    keys = ((keys + (BLOCK_BYTES - 1)) & ~((uintptr_t) (BLOCK_BYTES - 1)));
+    index->keys = (void*) keys;
+    index->values = ((char*) index->keys) + (blocks * BLOCK_BYTES);
+    index->allocator = buffer_set->allocator;
+    index->alloc_size = alloc_size;
+
+    buffer_set_cursor_t cursor;
+    void * value = buffer_set_cursor_first(buffer_set, &cursor);
+    _build(index, buffer_set, 0, &cursor, &value);
+    assert(value == NULL);
+    return index;
+}
+
+const void * buffer_set_int_index_get(
+    const buffer_set_int_index_t * index,
+    const void * key_ptr
+) {
+    // Descends to the leaf remembering the last position with a key
+    // not less than the searched one, which is the first such position
+    // in the in-order traversal.
+    const int64_t key = _read_key(index, key_ptr);
+    size_t pos = SIZE_MAX;
+    size_t block = 0;
+    if (index->key_type == BUFFER_SET_KEY_UINT64)
+    {
+        const int64_t * keys = index->keys;
+        while (block < index->blocks)
+        {
+            const unsigned int rank = index->rank64(keys + (block * KEYS64), key);
+            if (rank < KEYS64)
+                pos = (block * KEYS64 + rank);
+            block = _get_child(index, block, rank);
+        }
+        if ((pos == SIZE_MAX) || (keys[pos] != key) || ((key == INT64_MAX) && !index->has_max_key))
+            return NULL;
+    }
+    else
+    {
+        const int32_t * keys = index->keys;
+        const int32_t key32 = (int32_t) key;
+        while (block < index->blocks)
+        {
+            const unsigned int rank = index->rank32(keys + (block * KEYS32), key32);
+            if (rank < KEYS32)
+                pos = (block * KEYS32 + rank);
+            block = _get_child(index, block, rank);
+        }
+        if ((pos == SIZE_MAX) || (keys[pos] != key32) || ((key32 == INT32_MAX) && !index->has_max_key))
+            return NULL;
+    }
+    return index->values + (index->value_stride * pos);
+}
+
+void buffer_set_int_index_destroy(buffer_set_int_index_t * index)
+{
+    const buffer_set_allocator_t allocator = index->allocator;
+    allocator.free(index, index->alloc_size, allocator.ctx);
+}
@@ -0,0 +1,137 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#if !defined(BUFFER_SET_INTERNAL_H)
+#define BUFFER_SET_INTERNAL_H
+
+// Internal data layout of the buffer set shared by the library sources
+// and the type specialized sets (BUFFER_SET_DEFINE, buffer_set.hpp).
+// It is not installed, code including it is built together with
+// the library sources of the same version.
+
+#include <buffer_set/buffer_set.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct buffer_set_node_s
+{
+    buffer_set_size_t parent;
+    buffer_set_size_t left;
+    buffer_set_size_t right;
+    int8_t balance;
+};
+
+struct buffer_set_s
+{
+    size_t node_size;
+    // size of the node links with the augmented data following them,
+    // values are stored at this offset inside the nodes
+    size_t header_size;
+    size_t aggregate_offset;
+    void (*aggregate)(void * aggregate, const void * value, const void * left, const void * right, void * thunk);
+    size_t (*hash)(const void * value, void * thunk);
+    // Open addressing hash index of the nodes located at the end
+    // of the buffer, NULL if the set has no hash function.
+    buffer_set_size_t * hash_index;
+    size_t hash_mask;
+    size_t value_size;
+    size_t value_stride;
+    // Address of the value of the node 0, the value of the node idx
+    // is located at (values + idx * value_stride). Values are either stored
+    // inside the nodes (value_stride == node_size) or in a separate array
+    // following the nodes (BUFFER_SET_SPLIT_VALUES).
+    void * values;
+    int (*compar)(const void * v1, const void * v2, void * thunk);
+    void (*move)(void * dst, void * src, void * thunk);
+    void * thunk;
+    unsigned int flags;
+    buffer_set_allocator_t allocator;
+    unsigned int growth_factor;
+    buffer_set_size_t growth_step;
+    buffer_set_size_t (*grow)(buffer_set_size_t capacity, void * thunk);
+    buffer_set_size_t capacity;
+    buffer_set_size_t size;
+    buffer_set_size_t root;
+    void * buffer;
+    buffer_set_size_t free_list;
+    // BUFFER_SET_CONCURRENT_READS: the sequence counter is odd while
+    // the writer modifies the set, replaced buffers are retired with
+    // the current epoch and released when all readers left that epoch.
+    unsigned int seq;
+    unsigned int write_depth;
+    size_t epoch;
+    struct buffer_set_reader_slot_s * readers;
+    void * readers_alloc;
+    unsigned int max_readers;
+    struct buffer_set_retired_s * retired;
+    size_t retired_count;
+    size_t retired_capacity;
+    // snapshot sharing the buffer with the set, the buffer is copied
+    // before the set is modified
+    struct buffer_set_snapshot_s * snapshot;
+};
+
+#if defined(BUFFER_SET_WIDE_INDEX)
+#define buffer_set_default_allocator buffer_set32_default_allocator
+#define buffer_set_insert_leaf       buffer_set32_insert_leaf
+#endif
+
+// malloc(), realloc() and free(), used if the options have no allocator
+extern const buffer_set_allocator_t buffer_set_default_allocator;
+
+static inline struct buffer_set_node_s * _buffer_set_get_node(
+    const struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    char * ptr = (char*) buffer_set->buffer;
+    ptr += (buffer_set->node_size * idx);
+    return (struct buffer_set_node_s*) ptr;
+}
+
+static inline void * _buffer_set_get_value(
+    const struct buffer_set_s * buffer_set,
+    buffer_set_size_t idx
+) {
+    char * ptr = (char*) buffer_set->values;
+    ptr += (buffer_set->value_stride * idx);
+    return ptr;
+}
+
+/**
+ * Links a new leaf node as a child of the node at parent_idx
+ * (or as the root if parent_idx is 0) and rebalances the tree.
+ * The node is placed on the right side if cmp > 0, on the left side otherwise.
+ * Used by the type specialized sets after their own tree descent.
+ *
+ * @return
+ * A pointer to the uninitialized value of the new node, or NULL with errno
+ * set to EINVAL if the position is not a free child slot, or to ENOMEM
+ * if the buffer could not be grown.
+ */
+void * buffer_set_insert_leaf(
+    buffer_set_t * buffer_set,
+    const void * value,
+    buffer_set_size_t parent_idx,
+    int cmp
+);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* BUFFER_SET_INTERNAL_H */
@@ -0,0 +1,305 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include "buffer_set_internal.h"
+#include <errno.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+typedef SRWLOCK shard_lock_t;
+#define SHARD_LOCK_INIT(lock) InitializeSRWLock(lock)
+#define SHARD_LOCK_DESTROY(lock) ((void)0)
+#define SHARD_LOCK(lock) AcquireSRWLockExclusive(lock)
+#define SHARD_UNLOCK(lock) ReleaseSRWLockExclusive(lock)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t shard_lock_t;
+#define SHARD_LOCK_INIT(lock) pthread_mutex_init((lock), NULL)
+#define SHARD_LOCK_DESTROY(lock) pthread_mutex_destroy(lock)
+#define SHARD_LOCK(lock) pthread_mutex_lock(lock)
+#define SHARD_UNLOCK(lock) pthread_mutex_unlock(lock)
+#endif
+
+// Shards are aligned to the cache line, so locking one shard
+// does not invalidate the line of its neighbour.
+#define SHARD_ALIGN 64
+
+struct shard_s
+{
+    shard_lock_t lock;
+    buffer_set_t * buffer_set;
+};
+
+#define SHARD_SIZE (((sizeof(struct shard_s) + (SHARD_ALIGN - 1)) / SHARD_ALIGN) * SHARD_ALIGN)
+
+struct buffer_set_sharded_s
+{
+    size_t value_size;
+    int (*compar)(const void * v1, const void * v2, void * thunk);
+    size_t (*hash)(const void * value, void * thunk);
+    void * thunk;
+    buffer_set_allocator_t allocator;
+    size_t alloc_size;
+    unsigned int count;
+    char * shards;
+};
+
+struct buffer_set_sharded_iterator_s
+{
+    struct buffer_set_sharded_s * sharded;
+    size_t alloc_size;
+    // snapshots of the shards, their cursors and current values
+    buffer_set_snapshot_t ** snapshots;
+    buffer_set_cursor_t * cursors;
+    const void ** values;
+    // binary min heap of the shards by their current values
+    unsigned int * heap;
+    unsigned int heap_size;
+};
+
+static inline struct shard_s * _get_shard(struct buffer_set_sharded_s * sharded, unsigned int idx)
+{
+    return (struct shard_s*) (sharded->shards + (SHARD_SIZE * idx));
+}
+
+static struct shard_s * _find_shard(struct buffer_set_sharded_s * sharded, const void * value)
+{
+    // Mixes the hash bits, so the shards do not depend only on the low bits.
+    size_t hash = sharded->hash(value, sharded->thunk);
+    hash ^= (hash >> 16);
+    hash *= 0x45d9f3bu;
+    hash ^= (hash >> 16);
+    return _get_shard(sharded, (unsigned int) (hash % sharded->count));
+}
+
+buffer_set_sharded_t * buffer_set_sharded_create(
+    const buffer_set_options_t * options,
+    unsigned int shards,
+    size_t (*hash)(const void * value, void * thunk)
+) {
+    if (hash == NULL)
+        hash = options->hash;
+    if ((shards == 0) || (hash == NULL) || options->move || (options->flags & BUFFER_SET_CONCURRENT_READS))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    const buffer_set_allocator_t * allocator = options->allocator ? options->allocator : &buffer_set_default_allocator;
+    const size_t alloc_size = sizeof(struct buffer_set_sharded_s) + (SHARD_ALIGN - 1) + (SHARD_SIZE * shards);
+    struct buffer_set_sharded_s * sharded = allocator->alloc(alloc_size, allocator->ctx);
+    if (sharded == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    sharded->value_size = options->value_size;
+    sharded->compar = options->compar;
+    sharded->hash = hash;
+    sharded->thunk = options->thunk;
+    sharded->allocator = *allocator;
+    sharded->alloc_size = alloc_size;
+    sharded->count = shards;
+    uintptr_t ptr = (uintptr_t) (sharded + 1);
+    ptr = ((ptr + (SHARD_ALIGN - 1)) & ~((uintptr_t) (SHARD_ALIGN - 1)));
+    sharded->shards = (char*) ptr;
+
+    for (unsigned int idx=0; idx<shards; idx++)
+    {
+        struct shard_s * shard = _get_shard(sharded, idx);
+        shard->buffer_set = buffer_set_create_ex(options);
+        if (shard->buffer_set == NULL)
+        {
+            sharded->count = idx;
+            buffer_set_sharded_destroy(sharded);
+            errno = ENOMEM;
+            return NULL;
+        }
+        SHARD_LOCK_INIT(&shard->lock);
+    }
+
+    return sharded;
+}
+
+void buffer_set_sharded_destroy(buffer_set_sharded_t * sharded)
+{
+    for (unsigned int idx=0; idx<sharded->count; idx++)
+    {
+        struct shard_s * shard = _get_shard(sharded, idx);
+        SHARD_LOCK_DESTROY(&shard->lock);
+        buffer_set_destroy(shard->buffer_set);
+    }
+    const buffer_set_allocator_t allocator = sharded->allocator;
+    allocator.free(sharded, sharded->alloc_size, allocator.ctx);
+}
+
+size_t buffer_set_sharded_get_size(buffer_set_sharded_t * sharded)
+{
+    size_t size = 0;
+    for (unsigned int idx=0; idx<sharded->count; idx++)
+    {
+        struct shard_s * shard = _get_shard(sharded, idx);
+        SHARD_LOCK(&shard->lock);
+        size += buffer_set_get_size(shard->buffer_set);
+        SHARD_UNLOCK(&shard->lock);
+    }
+    return size;
+}
+
+int buffer_set_sharded_insert(
+    buffer_set_sharded_t * sharded,
+    const void * value
+) {
+    struct shard_s * shard = _find_shard(sharded, value);
+    int inserted;
+    SHARD_LOCK(&shard->lock);
+    void * ptr = buffer_set_insert(shard->buffer_set, value, &inserted);
+    if (ptr && inserted)
+        memcpy(ptr, value, sharded->value_size);
+    SHARD_UNLOCK(&shard->lock);
+    return ptr ? inserted : -1;
+}
+
+int buffer_set_sharded_get(
+    buffer_set_sharded_t * sharded,
+    const void * value,
+    void * out
+) {
+    struct shard_s * shard = _find_shard(sharded, value);
+    SHARD_LOCK(&shard->lock);
+    const void * ptr = buffer_set_get(shard->buffer_set, value);
+    if (ptr && out)
+        memcpy(out, ptr, sharded->value_size);
+    SHARD_UNLOCK(&shard->lock);
+    return (ptr != NULL);
+}
+
+int buffer_set_sharded_erase(
+    buffer_set_sharded_t * sharded,
+    const void * value,
+    void * out
+) {
+    struct shard_s * shard = _find_shard(sharded, value);
+    SHARD_LOCK(&shard->lock);
+    const void * ptr = buffer_set_erase(shard->buffer_set, value);
+    if (ptr && out)
+        memcpy(out, ptr, sharded->value_size);
+    SHARD_UNLOCK(&shard->lock);
+    return (ptr != NULL);
+}
+
+static inline int _heap_less(struct buffer_set_sharded_iterator_s * it, unsigned int a, unsigned int b)
+{
+    struct buffer_set_sharded_s * sharded = it->sharded;
+    return (sharded->compar(it->values[it->heap[a]], it->values[it->heap[b]], sharded->thunk) < 0);
+}
+
+static void _heap_sift_down(struct buffer_set_sharded_iterator_s * it, unsigned int pos)
+{
+    for (;;)
+    {
+        unsigned int min_pos = pos;
+        const unsigned int left = (pos * 2 + 1);
+        const unsigned int right = (left + 1);
+        if ((left < it->heap_size) && _heap_less(it, left, min_pos))
+            min_pos = left;
+        if ((right < it->heap_size) && _heap_less(it, right, min_pos))
+            min_pos = right;
+        if (min_pos == pos)
+            return;
+        const unsigned int tmp = it->heap[pos];
+        it->heap[pos] = it->heap[min_pos];
+        it->heap[min_pos] = tmp;
+        pos = min_pos;
+    }
+}
+
+buffer_set_sharded_iterator_t * buffer_set_sharded_iterator_create(buffer_set_sharded_t * sharded)
+{
+    const unsigned int count = sharded->count;
+    const size_t alloc_size = sizeof(struct buffer_set_sharded_iterator_s) +
+        (count * (sizeof(buffer_set_cursor_t) + sizeof(buffer_set_snapshot_t*) + sizeof(void*) + sizeof(unsigned int)));
+    struct buffer_set_sharded_iterator_s * it = sharded->allocator.alloc(alloc_size, sharded->allocator.ctx);
+    if (it == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // cursors go first, the other arrays have smaller alignment
+    it->sharded = sharded;
+    it->alloc_size = alloc_size;
+    it->cursors = (buffer_set_cursor_t*) (it + 1);
+    it->snapshots = (buffer_set_snapshot_t**) (it->cursors + count);
+    it->values = (const void**) (it->snapshots + count);
+    it->heap = (unsigned int*) (it->values + count);
+    it->heap_size = 0;
+
+    // A snapshot of each shard is taken under its lock, the writers
+    // are not blocked while the iterator walks the snapshots.
+    for (unsigned int idx=0; idx<count; idx++)
+    {
+        struct shard_s * shard = _get_shard(sharded, idx);
+        SHARD_LOCK(&shard->lock);
+        it->snapshots[idx] = buffer_set_snapshot(shard->buffer_set);
+        SHARD_UNLOCK(&shard->lock);
+        if (it->snapshots[idx] == NULL)
+        {
+            // errno is set by buffer_set_snapshot()
+            const int error = errno;
+            while (idx-- > 0)
+                buffer_set_snapshot_release(it->snapshots[idx]);
+            sharded->allocator.free(it, alloc_size, sharded->allocator.ctx);
+            errno = error;
+            return NULL;
+        }
+
+        buffer_set_t * buffer_set = buffer_set_snapshot_get_set(it->snapshots[idx]);
+        it->values[idx] = buffer_set_cursor_first(buffer_set, &it->cursors[idx]);
+        if (it->values[idx])
+            it->heap[it->heap_size++] = idx;
+    }
+
+    for (unsigned int pos=(it->heap_size / 2); pos-->0;)
+        _heap_sift_down(it, pos);
+    return it;
+}
+
+const void * buffer_set_sharded_iterator_next(buffer_set_sharded_iterator_t * it)
+{
+    if (it->heap_size == 0)
+        return NULL;
+
+    // the value stays valid in the snapshot while the cursor advances
+    const unsigned int idx = it->heap[0];
+    const void * value = it->values[idx];
+    buffer_set_t * buffer_set = buffer_set_snapshot_get_set(it->snapshots[idx]);
+    it->values[idx] = buffer_set_cursor_next(buffer_set, &it->cursors[idx]);
+    if (it->values[idx] == NULL)
+        it->heap[0] = it->heap[--it->heap_size];
+    _heap_sift_down(it, 0);
+    return value;
+}
+
+void buffer_set_sharded_iterator_destroy(buffer_set_sharded_iterator_t * it)
+{
+    struct buffer_set_sharded_s * sharded = it->sharded;
+    for (unsigned int idx=0; idx<sharded->count; idx++)
+        buffer_set_snapshot_release(it->snapshots[idx]);
+    sharded->allocator.free(it, it->alloc_size, sharded->allocator.ctx);
+}
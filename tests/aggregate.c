@@ -0,0 +1,190 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define RANGE 2000
+#define OPS 10000
+
+struct value_s
+{
+    int key;
+    int qty;
+};
+
+struct aggregate_s
+{
+    int sum;
+    int max;
+};
+
+static int value_cmp(const void * v1, const void * v2, void * thunk)
+{
+    const struct value_s * value1 = v1;
+    const struct value_s * value2 = v2;
+    return (value1->key > value2->key) - (value1->key < value2->key);
+}
+
+static void value_aggregate(void * aggregate, const void * value, const void * left, const void * right, void * thunk)
+{
+    struct aggregate_s * result = aggregate;
+    const struct aggregate_s * left_aggregate = left;
+    const struct aggregate_s * right_aggregate = right;
+    const int qty = ((const struct value_s*) value)->qty;
+    result->sum = qty;
+    result->max = qty;
+    if (left_aggregate)
+    {
+        result->sum += left_aggregate->sum;
+        if (result->max < left_aggregate->max)
+            result->max = left_aggregate->max;
+    }
+    if (right_aggregate)
+    {
+        result->sum += right_aggregate->sum;
+        if (result->max < right_aggregate->max)
+            result->max = right_aggregate->max;
+    }
+}
+
+static int _sum_less(buffer_set_t * buffer_set, int key)
+{
+    // sum of quantities of values with the key less than the given one
+    int sum = 0;
+    buffer_set_iterator_t * it = buffer_set_root(buffer_set);
+    while (it != buffer_set_end(buffer_set))
+    {
+        const struct value_s * value = buffer_set_get_at(buffer_set, it);
+        buffer_set_iterator_t * left = buffer_set_iterator_left(buffer_set, it);
+        if (value->key < key)
+        {
+            if (left != buffer_set_end(buffer_set))
+                sum += ((const struct aggregate_s*) buffer_set_get_aggregate(buffer_set, left))->sum;
+            sum += value->qty;
+            it = buffer_set_iterator_right(buffer_set, it);
+        }
+        else
+            it = left;
+    }
+    return sum;
+}
+
+static int _check(buffer_set_t * buffer_set, const int * qty)
+{
+    if (buffer_set_verify(buffer_set, stderr) != 0)
+        return -1;
+
+    int sum = 0;
+    int max = 0;
+    for (int key=0; key<RANGE; key++)
+    {
+        if (_sum_less(buffer_set, key) != sum)
+        {
+            fprintf(stderr, "unexpected sum %d for keys less than %d, expected %d\n", _sum_less(buffer_set, key), key, sum);
+            return -1;
+        }
+        sum += qty[key];
+        if (max < qty[key])
+            max = qty[key];
+    }
+
+    if (buffer_set_get_size(buffer_set) > 0)
+    {
+        const struct aggregate_s * aggregate = buffer_set_get_aggregate(buffer_set, buffer_set_root(buffer_set));
+        if ((aggregate->sum != sum) || (aggregate->max != max))
+        {
+            fprintf(stderr, "unexpected root aggregate %d/%d, expected %d/%d\n", aggregate->sum, aggregate->max, sum, max);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int _aggregate(unsigned int flags)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(struct value_s);
+    options.compar = &value_cmp;
+    options.flags = flags;
+    options.aggregate_size = sizeof(struct aggregate_s);
+    options.aggregate = &value_aggregate;
+
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    // quantity of the value with the key, 0 if not in the set
+    int * qty = calloc(RANGE, sizeof(int));
+    if ((buffer_set == NULL) || (qty == NULL))
+    {
+        printf("not enough memory");
+        if (buffer_set)
+            buffer_set_destroy(buffer_set);
+        free(qty);
+        return -1;
+    }
+
+    int rc = 0;
+    unsigned int seed = 4321;
+    for (int op=0; (rc == 0) && (op<OPS); op++)
+    {
+        seed = (seed * 1103515245 + 12345);
+        struct value_s value;
+        value.key = (int) ((seed >> 8) % RANGE);
+        value.qty = (int) ((seed >> 4) % 100) + 1;
+        const int action = (int) ((seed >> 20) % 4);
+        if (action < 2)
+        {
+            // the value is copied into the set by the insert
+            int inserted;
+            buffer_set_insert(buffer_set, &value, &inserted);
+            if (inserted)
+                qty[value.key] = value.qty;
+        }
+        else if (action == 2)
+        {
+            if (buffer_set_erase(buffer_set, &value))
+                qty[value.key] = 0;
+        }
+        else
+        {
+            // modify the quantity in place
+            buffer_set_iterator_t * it = buffer_set_find(buffer_set, &value);
+            if (it != buffer_set_end(buffer_set))
+            {
+                ((struct value_s*) buffer_set_get_at(buffer_set, it))->qty = value.qty;
+                buffer_set_update_aggregate(buffer_set, it);
+                qty[value.key] = value.qty;
+            }
+        }
+
+        if ((op % 1000) == 999)
+            rc = _check(buffer_set, qty);
+    }
+
+    buffer_set_destroy(buffer_set);
+    free(qty);
+    return rc;
+}
+
+int aggregate()
+{
+    if (_aggregate(0) != 0)
+        return -1;
+    if (_aggregate(BUFFER_SET_SPLIT_VALUES | BUFFER_SET_ORDER_STATISTICS) != 0)
+        return -1;
+    return 0;
+}
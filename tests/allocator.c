@@ -0,0 +1,156 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+struct arena_s
+{
+    size_t allocated;
+    int blocks;
+    int realloc_calls;
+};
+
+static void * arena_alloc(size_t size, void * ctx)
+{
+    struct arena_s * arena = ctx;
+    size_t * ptr = malloc(sizeof(size_t) + size);
+    if (ptr == NULL)
+        return NULL;
+    *ptr = size;
+    arena->allocated += size;
+    arena->blocks++;
+    return (ptr + 1);
+}
+
+static void arena_free(void * ptr, size_t size, void * ctx)
+{
+    struct arena_s * arena = ctx;
+    size_t * block = ((size_t*) ptr) - 1;
+    if (*block != size)
+    {
+        // make the test fail
+        arena->blocks += 1000;
+    }
+    arena->allocated -= size;
+    arena->blocks--;
+    free(block);
+}
+
+static void * arena_realloc(void * ptr, size_t old_size, size_t new_size, void * ctx)
+{
+    struct arena_s * arena = ctx;
+    arena->realloc_calls++;
+    void * new_ptr = arena_alloc(new_size, ctx);
+    if (new_ptr)
+    {
+        memcpy(new_ptr, ptr, (old_size < new_size) ? old_size : new_size);
+        arena_free(ptr, old_size, ctx);
+    }
+    return new_ptr;
+}
+
+static int _allocator(int with_realloc, unsigned int flags)
+{
+    struct arena_s arena;
+    memset(&arena, 0, sizeof(arena));
+
+    buffer_set_allocator_t allocator;
+    allocator.alloc = &arena_alloc;
+    allocator.realloc = with_realloc ? &arena_realloc : NULL;
+    allocator.free = &arena_free;
+    allocator.ctx = &arena;
+
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_cmp;
+    options.flags = flags;
+    options.allocator = &allocator;
+
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    int rc = 0;
+    if (arena.blocks != 1)
+    {
+        fprintf(stderr, "set header is expected to be allocated from the arena\n");
+        rc = -1;
+    }
+
+    for (int idx=0; idx<2000; idx++)
+    {
+        int inserted;
+        int * value = buffer_set_insert(buffer_set, &idx, &inserted);
+        *value = idx;
+    }
+
+    if (arena.blocks != 2)
+    {
+        fprintf(stderr, "unexpected number of blocks allocated: %d\n", arena.blocks);
+        rc = -1;
+    }
+
+    for (int idx=0; idx<1900; idx++)
+        buffer_set_erase(buffer_set, &idx);
+    buffer_set_shrink(buffer_set);
+
+    if (with_realloc && (arena.realloc_calls == 0))
+    {
+        fprintf(stderr, "realloc function not used\n");
+        rc = -1;
+    }
+
+    if (buffer_set_verify(buffer_set, stderr) != 0)
+        rc = -1;
+
+    for (int idx=1900; idx<2000; idx++)
+    {
+        int * value = buffer_set_get(buffer_set, &idx);
+        if ((value == NULL) || (*value != idx))
+        {
+            fprintf(stderr, "value %d not found\n", idx);
+            rc = -1;
+            break;
+        }
+    }
+
+    buffer_set_destroy(buffer_set);
+
+    if ((arena.blocks != 0) || (arena.allocated != 0))
+    {
+        fprintf(stderr, "arena leaked %d blocks (%zu bytes)\n", arena.blocks, arena.allocated);
+        rc = -1;
+    }
+
+    return rc;
+}
+
+int allocator()
+{
+    if (_allocator(1, 0) != 0)
+        return -1;
+    if (_allocator(0, 0) != 0)
+        return -1;
+    if (_allocator(1, BUFFER_SET_SPLIT_VALUES) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define COUNT 301
+#define MAX_VALUE (((COUNT - 1) / 3) * 2)
+
+int batch()
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    int values[COUNT];
+    int inserted[COUNT];
+    buffer_set_iterator_t * result[COUNT];
+    int ret = 0;
+
+    // even values, every value repeated 3 times in a row
+    for (int idx=0; idx<COUNT; idx++)
+        values[idx] = ((idx / 3) * 2);
+
+    if (buffer_set_insert_many(buffer_set, values, COUNT, inserted) != 0)
+    {
+        printf("buffer_set_insert_many() failed");
+        ret = -1;
+    }
+
+    for (int idx=0; (ret == 0) && (idx<COUNT); idx++)
+    {
+        if (inserted[idx] != ((idx % 3) == 0))
+        {
+            printf("unexpected inserted flag for value %d at %d", values[idx], idx);
+            ret = -1;
+        }
+    }
+
+    if ((ret == 0) && (buffer_set_get_size(buffer_set) != (COUNT + 2) / 3))
+    {
+        printf("unexpected size %u", (unsigned int) buffer_set_get_size(buffer_set));
+        ret = -1;
+    }
+
+    if ((ret == 0) && (buffer_set_verify(buffer_set, stdout) != 0))
+        ret = -1;
+
+    if (ret == 0)
+    {
+        for (int idx=0; idx<COUNT; idx++)
+            values[idx] = idx;
+        buffer_set_find_many(buffer_set, values, COUNT, result);
+        for (int idx=0; idx<COUNT; idx++)
+        {
+            const int found = (result[idx] != buffer_set_end(buffer_set));
+            const int expected = ((idx % 2) == 0) && (idx <= MAX_VALUE);
+            if (found != expected)
+            {
+                printf("unexpected lookup result for %d", idx);
+                ret = -1;
+                break;
+            }
+            if (found && (*((const int*) buffer_set_get_at(buffer_set, result[idx])) != idx))
+            {
+                printf("unexpected value found for %d", idx);
+                ret = -1;
+                break;
+            }
+        }
+    }
+
+    buffer_set_destroy(buffer_set);
+
+    return ret;
+}
@@ -0,0 +1,108 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define COUNT 500
+
+struct visit_s
+{
+    int count;
+    int sum;
+    int limit;
+};
+
+static int visit(void * value, void * arg)
+{
+    struct visit_s * visit = arg;
+    visit->count++;
+    visit->sum += *((int*)value);
+    return (visit->count == visit->limit) ? 7 : 0;
+}
+
+static int _get(buffer_set_t * buffer_set, buffer_set_iterator_t * it)
+{
+    // -1 for the end iterator
+    return (it == buffer_set_end(buffer_set)) ? -1 : *((int*) buffer_set_get_at(buffer_set, it));
+}
+
+int bounds()
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    // even values 0, 2, ..., 2 * (COUNT - 1)
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        int inserted;
+        const int value = (idx * 2);
+        int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        *ptr = value;
+    }
+
+    int rc = 0;
+    for (int value=-1; value<=(COUNT * 2); value++)
+    {
+        const int lower = _get(buffer_set, buffer_set_lower_bound(buffer_set, &value));
+        const int upper = _get(buffer_set, buffer_set_upper_bound(buffer_set, &value));
+        const int expected_lower = (value < 0) ? 0 : (((value + 1) / 2) * 2);
+        const int expected_upper = (value < 0) ? 0 : ((value / 2 + 1) * 2);
+        if ((lower != ((expected_lower < COUNT * 2) ? expected_lower : -1)) ||
+            (upper != ((expected_upper < COUNT * 2) ? expected_upper : -1)))
+        {
+            fprintf(stderr, "unexpected bounds %d/%d for %d\n", lower, upper, value);
+            rc = -1;
+            break;
+        }
+    }
+
+    // [10, 21) contains 10, 12, ..., 20
+    const int lo = 10;
+    const int hi = 21;
+    struct visit_s v;
+    memset(&v, 0, sizeof(v));
+    if ((buffer_set_visit_range(buffer_set, &lo, &hi, &visit, &v) != 0) || (v.count != 6) || (v.sum != 90))
+    {
+        fprintf(stderr, "unexpected range visit %d/%d\n", v.count, v.sum);
+        rc = -1;
+    }
+
+    // stopped by the callback
+    memset(&v, 0, sizeof(v));
+    v.limit = 3;
+    if ((buffer_set_visit_range(buffer_set, &lo, NULL, &visit, &v) != 7) || (v.count != 3) || (v.sum != 36))
+    {
+        fprintf(stderr, "range visit not stopped %d/%d\n", v.count, v.sum);
+        rc = -1;
+    }
+
+    // unlimited range visits all values
+    memset(&v, 0, sizeof(v));
+    if ((buffer_set_visit_range(buffer_set, NULL, NULL, &visit, &v) != 0) || (v.count != COUNT))
+    {
+        fprintf(stderr, "unexpected full range visit %d\n", v.count);
+        rc = -1;
+    }
+
+    buffer_set_destroy(buffer_set);
+    return rc;
+}
@@ -0,0 +1,114 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define COUNT 1000
+
+static int check_content(buffer_set_t * buffer_set, const int * values, int count)
+{
+    if (buffer_set_verify(buffer_set, stdout) != 0)
+        return -1;
+
+    if ((int) buffer_set_get_size(buffer_set) != count)
+    {
+        printf("unexpected size %u instead of %d", (unsigned int) buffer_set_get_size(buffer_set), count);
+        return -1;
+    }
+
+    int idx = 0;
+    buffer_set_iterator_t * it = buffer_set_begin(buffer_set);
+    for (; it != buffer_set_end(buffer_set); it = buffer_set_iterator_next(buffer_set, it), idx++)
+    {
+        const int value = *((const int*) buffer_set_get_at(buffer_set, it));
+        if (value != values[idx])
+        {
+            printf("got %d instead of %d", value, values[idx]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int build_sorted()
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    int * values = malloc(sizeof(int) * COUNT);
+    int ret = 0;
+
+    for (int count=0; (ret == 0) && (count<=COUNT); count+=(count < 40) ? 1 : 97)
+    {
+        for (int idx=0; idx<count; idx++)
+            values[idx] = (idx * 2);
+        if (buffer_set_build_sorted(buffer_set, values, count) != 0)
+        {
+            printf("buffer_set_build_sorted() failed for %d values", count);
+            ret = -1;
+        }
+        else
+            ret = check_content(buffer_set, values, count);
+    }
+
+    // the set built from sorted values should be still usable as usual
+    for (int idx=0; (ret == 0) && (idx<100); idx++)
+    {
+        int value = (idx * 2) + 1;
+        int inserted;
+        int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        if (!ptr || !inserted)
+        {
+            printf("buffer_set_insert() failed for %d", value);
+            ret = -1;
+        }
+        else
+        {
+            *ptr = value;
+            value = (idx * 2);
+            if (buffer_set_erase(buffer_set, &value) == NULL)
+            {
+                printf("buffer_set_erase() failed for %d", value);
+                ret = -1;
+            }
+        }
+    }
+
+    if ((ret == 0) && (buffer_set_verify(buffer_set, stdout) != 0))
+        ret = -1;
+
+    if (ret == 0)
+    {
+        values[0] = 5;
+        values[1] = 5;
+        if (buffer_set_build_sorted(buffer_set, values, 2) == 0)
+        {
+            printf("buffer_set_build_sorted() unexpectedly accepted duplicates");
+            ret = -1;
+        }
+    }
+
+    free(values);
+    buffer_set_destroy(buffer_set);
+
+    return ret;
+}
@@ -0,0 +1,117 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+
+struct record_s
+{
+    char name[16];
+    int payload[48];
+};
+
+static int _record_cmp(const void * v1, const void * v2, void * thunk)
+{
+    (void) thunk;
+    return strcmp(((const struct record_s*) v1)->name, ((const struct record_s*) v2)->name);
+}
+
+static int _name_cmp(const void * key, const void * value, void * thunk)
+{
+    (void) thunk;
+    return strcmp((const char*) key, ((const struct record_s*) value)->name);
+}
+
+int by_key()
+{
+    const int count = 500;
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(struct record_s), 0, &_record_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    // even numbers as names
+    for (int idx=0; idx<count; idx++)
+    {
+        int inserted;
+        struct record_s record;
+        memset(&record, 0, sizeof(record));
+        snprintf(record.name, sizeof(record.name), "%d", ((idx * 7) % count) * 2);
+        record.payload[0] = (((idx * 7) % count) * 2);
+        struct record_s * ptr = buffer_set_insert(buffer_set, &record, &inserted);
+        *ptr = record;
+    }
+
+    int rc = 0;
+    for (int idx=0; (rc == 0) && (idx<(count * 2)); idx++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "%d", idx);
+        const struct record_s * ptr = buffer_set_get_by_key(buffer_set, name, &_name_cmp);
+        buffer_set_iterator_t * it = buffer_set_find_by_key(buffer_set, name, &_name_cmp);
+        const int found = ((idx & 1) == 0);
+        if ((ptr != NULL) != found)
+        {
+            fprintf(stderr, "key %s is unexpectedly %s\n", name, ptr ? "found" : "not found");
+            rc = -1;
+        }
+        else if (ptr && (ptr->payload[0] != idx))
+        {
+            fprintf(stderr, "unexpected record for the key %s\n", name);
+            rc = -1;
+        }
+        else if ((it == buffer_set_end(buffer_set)) == found)
+        {
+            fprintf(stderr, "unexpected iterator for the key %s\n", name);
+            rc = -1;
+        }
+        else if (found && (buffer_set_get_at(buffer_set, it) != ptr))
+        {
+            fprintf(stderr, "iterator for the key %s does not point to the record\n", name);
+            rc = -1;
+        }
+    }
+
+    // erase every other record
+    for (int idx=0; (rc == 0) && (idx<(count * 2)); idx+=2)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "%d", idx);
+        const struct record_s * ptr = buffer_set_erase_by_key(buffer_set, name, &_name_cmp);
+        if ((ptr == NULL) || (ptr->payload[0] != idx))
+        {
+            fprintf(stderr, "failed to erase the key %s\n", name);
+            rc = -1;
+        }
+        else if (buffer_set_erase_by_key(buffer_set, name, &_name_cmp) != NULL)
+        {
+            fprintf(stderr, "key %s is erased twice\n", name);
+            rc = -1;
+        }
+    }
+
+    if ((rc == 0) && ((buffer_set_get_size(buffer_set) != 0) || (buffer_set_verify(buffer_set, stderr) != 0)))
+    {
+        fprintf(stderr, "set is not empty after erasing all keys\n");
+        rc = -1;
+    }
+
+    buffer_set_destroy(buffer_set);
+    return rc;
+}
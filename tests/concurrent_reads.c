@@ -0,0 +1,277 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+typedef HANDLE thread_t;
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+#endif
+
+#define READERS 4
+#define PERMANENT 1000
+#define RANGE 12000
+#define ROUNDS 10
+
+struct value_s
+{
+    int key;
+    int check;
+};
+
+struct reader_s
+{
+    buffer_set_t * buffer_set;
+    volatile int * stop;
+    int reader;
+    int errors;
+    unsigned int lookups;
+};
+
+static int value_cmp(const void * v1, const void * v2, void * thunk)
+{
+    const int key1 = ((const struct value_s*) v1)->key;
+    const int key2 = ((const struct value_s*) v2)->key;
+    (void) thunk;
+    return (key1 > key2) - (key1 < key2);
+}
+
+static void _reader(struct reader_s * reader)
+{
+    unsigned int random = (unsigned int) (reader->reader + 1);
+    while (!*reader->stop)
+    {
+        // odd keys below PERMANENT * 2 are never erased
+        random = (random * 1103515245u) + 12345u;
+        struct value_s value;
+        value.key = (int) ((random >> 8) % RANGE);
+        struct value_s found;
+        const int rc = buffer_set_reader_get(reader->buffer_set, reader->reader, &value, &found);
+        if (rc && ((found.key != value.key) || (found.check != ((value.key * 3) + 1))))
+            reader->errors++;
+        else if (!rc && (value.key & 1) && (value.key < (PERMANENT * 2)))
+            reader->errors++;
+        reader->lookups++;
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI _reader_thread(LPVOID arg)
+{
+    _reader(arg);
+    return 0;
+}
+#else
+static void * _reader_thread(void * arg)
+{
+    _reader(arg);
+    return NULL;
+}
+#endif
+
+static int _insert(buffer_set_t * buffer_set, int key)
+{
+    // the value is filled inside the write section as well
+    int inserted;
+    buffer_set_write_begin(buffer_set);
+    struct value_s value;
+    value.key = key;
+    struct value_s * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+    if (ptr)
+    {
+        ptr->key = key;
+        ptr->check = ((key * 3) + 1);
+    }
+    buffer_set_write_end(buffer_set);
+    return (ptr == NULL) ? -1 : 0;
+}
+
+static int _concurrent_reads(unsigned int flags)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(struct value_s);
+    options.compar = &value_cmp;
+    options.flags = (flags | BUFFER_SET_CONCURRENT_READS);
+    options.max_readers = READERS;
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    int rc = 0;
+    for (int key=1; key<(PERMANENT * 2); key+=2)
+    {
+        if (_insert(buffer_set, key) != 0)
+            rc = -1;
+    }
+
+    volatile int stop = 0;
+    struct reader_s readers[READERS];
+    thread_t threads[READERS];
+    for (int idx=0; idx<READERS; idx++)
+    {
+        readers[idx].buffer_set = buffer_set;
+        readers[idx].stop = &stop;
+        readers[idx].reader = buffer_set_reader_register(buffer_set);
+        readers[idx].errors = 0;
+        readers[idx].lookups = 0;
+        if (readers[idx].reader < 0)
+            rc = -1;
+    }
+
+    if ((buffer_set_reader_register(buffer_set) != -1) || (errno != EAGAIN))
+    {
+        fprintf(stderr, "unexpected reader registered over the limit\n");
+        rc = -1;
+    }
+
+    if (rc != 0)
+    {
+        buffer_set_destroy(buffer_set);
+        return -1;
+    }
+
+    for (int idx=0; idx<READERS; idx++)
+    {
+#if defined(_WIN32)
+        threads[idx] = CreateThread(NULL, 0, &_reader_thread, &readers[idx], 0, NULL);
+#else
+        pthread_create(&threads[idx], NULL, &_reader_thread, &readers[idx]);
+#endif
+    }
+
+    // the buffer grows and shrinks while the readers walk the tree
+    for (int round=0; (rc == 0) && (round<ROUNDS); round++)
+    {
+        for (int idx=0; (rc == 0) && (idx<(RANGE / 2)); idx++)
+        {
+            const int key = ((((idx * 7919) % (RANGE / 2)) * 2) + ((round & 1) ? 0 : (PERMANENT * 2)));
+            if ((key & 1) || (key >= RANGE))
+                continue;
+            rc = _insert(buffer_set, key);
+        }
+
+        buffer_set_write_begin(buffer_set);
+        for (int key=0; key<RANGE; key+=2)
+        {
+            struct value_s value;
+            value.key = key;
+            buffer_set_erase(buffer_set, &value);
+        }
+        buffer_set_shrink(buffer_set);
+        if ((round % 3) == 2)
+            buffer_set_optimize_layout(buffer_set);
+        buffer_set_write_end(buffer_set);
+    }
+
+    stop = 1;
+    for (int idx=0; idx<READERS; idx++)
+    {
+#if defined(_WIN32)
+        WaitForSingleObject(threads[idx], INFINITE);
+        CloseHandle(threads[idx]);
+#else
+        pthread_join(threads[idx], NULL);
+#endif
+        if (readers[idx].errors)
+        {
+            fprintf(stderr, "reader %d got %d inconsistent results of %u lookups\n",
+                idx, readers[idx].errors, readers[idx].lookups);
+            rc = -1;
+        }
+        buffer_set_reader_unregister(buffer_set, readers[idx].reader);
+    }
+
+    if ((rc == 0) && (buffer_set_verify(buffer_set, stderr) != 0))
+        rc = -1;
+
+    buffer_set_destroy(buffer_set);
+    return rc;
+}
+
+// Sets derived by the set operations keep the flag and can be read concurrently.
+static int _derived_set()
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(struct value_s);
+    options.compar = &value_cmp;
+    options.flags = BUFFER_SET_CONCURRENT_READS;
+    buffer_set_t * a = buffer_set_create_ex(&options);
+    buffer_set_t * b = buffer_set_create_ex(&options);
+    if ((a == NULL) || (b == NULL))
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    int rc = 0;
+    for (int key=0; key<100; key++)
+        rc |= _insert(((key & 1) ? b : a), key);
+
+    buffer_set_t * result = (rc == 0) ? buffer_set_union(a, b) : NULL;
+    if (result == NULL)
+        rc = -1;
+    else
+    {
+        const int reader = buffer_set_reader_register(result);
+        for (int key=0; (rc == 0) && (key<100); key++)
+        {
+            struct value_s value;
+            struct value_s found;
+            value.key = key;
+            if ((buffer_set_reader_get(result, reader, &value, &found) != 1) || (found.check != ((key * 3) + 1)))
+            {
+                fprintf(stderr, "value %d is not found in the union\n", key);
+                rc = -1;
+            }
+        }
+        buffer_set_reader_unregister(result, reader);
+        // the writer of the result modifies it in a write section
+        if ((rc == 0) && ((_insert(result, 100) != 0) || (buffer_set_verify(result, stderr) != 0)))
+            rc = -1;
+        buffer_set_destroy(result);
+    }
+
+    buffer_set_destroy(a);
+    buffer_set_destroy(b);
+    return rc;
+}
+
+int concurrent_reads()
+{
+    if (_concurrent_reads(0) != 0)
+        return -1;
+    if (_concurrent_reads(BUFFER_SET_SPLIT_VALUES) != 0)
+        return -1;
+    if (_derived_set() != 0)
+        return -1;
+
+    // a set without the flag has no readers
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    const int reader = buffer_set_reader_register(buffer_set);
+    buffer_set_destroy(buffer_set);
+    return ((reader == -1) && (errno == EINVAL)) ? 0 : -1;
+}
@@ -0,0 +1,78 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define COUNT 5000
+
+int cursor()
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    int rc = 0;
+    buffer_set_cursor_t cursor;
+    if (buffer_set_cursor_first(buffer_set, &cursor) != NULL)
+    {
+        fprintf(stderr, "cursor of an empty set is expected to be at the end\n");
+        rc = -1;
+    }
+
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        int inserted;
+        const int value = ((idx * 7919) % 10007);
+        int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        *ptr = value;
+    }
+
+    buffer_set_iterator_t * it = buffer_set_begin(buffer_set);
+    int count = 0;
+    for (int * value = buffer_set_cursor_first(buffer_set, &cursor);
+         value != NULL;
+         value = buffer_set_cursor_next(buffer_set, &cursor))
+    {
+        if (value != buffer_set_get_at(buffer_set, it))
+        {
+            fprintf(stderr, "cursor and iterator diverged at %d\n", count);
+            rc = -1;
+            break;
+        }
+        it = buffer_set_iterator_next(buffer_set, it);
+        count++;
+    }
+
+    if ((rc == 0) && ((count != COUNT) || (it != buffer_set_end(buffer_set))))
+    {
+        fprintf(stderr, "cursor visited %d values instead of %d\n", count, COUNT);
+        rc = -1;
+    }
+
+    if (buffer_set_cursor_next(buffer_set, &cursor) != NULL)
+    {
+        fprintf(stderr, "cursor is expected to stay at the end\n");
+        rc = -1;
+    }
+
+    buffer_set_destroy(buffer_set);
+    return rc;
+}
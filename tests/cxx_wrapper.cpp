@@ -0,0 +1,83 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.hpp>
+#include <cstdio>
+#include <string>
+
+#define COUNT 100
+
+extern "C" int cxx_wrapper()
+{
+    // std::string is not trivially copyable,
+    // so the buffer growth goes through the move callback
+    js_labs::buffer_set<std::string> set;
+
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        const std::string value = std::to_string(1000 + idx);
+        std::pair<std::string*, bool> result = set.insert(value);
+        if (!result.second || (*result.first != value))
+        {
+            printf("insert() failed for %s", value.c_str());
+            return -1;
+        }
+    }
+
+    if (set.insert(std::to_string(1000)).second)
+    {
+        printf("insert() unexpectedly inserted a duplicate");
+        return -1;
+    }
+
+    for (int idx=0; idx<COUNT; idx+=2)
+    {
+        if (!set.erase(std::to_string(1000 + idx)))
+        {
+            printf("erase() failed for %d", 1000 + idx);
+            return -1;
+        }
+    }
+
+    int expected = 1001;
+    for (const std::string & value : set)
+    {
+        if (value != std::to_string(expected))
+        {
+            printf("got %s instead of %d", value.c_str(), expected);
+            return -1;
+        }
+        expected += 2;
+    }
+
+    js_labs::buffer_set<std::string>::iterator it = set.end();
+    for (expected = 1000 + COUNT - 1; expected > 1000; expected -= 2)
+    {
+        --it;
+        if (*it != std::to_string(expected))
+        {
+            printf("got %s instead of %d in reverse order", it->c_str(), expected);
+            return -1;
+        }
+    }
+
+    if ((set.size() != COUNT/2) || (set.find(std::to_string(1001)) == nullptr) || (set.find("x") != nullptr))
+    {
+        printf("unexpected set content");
+        return -1;
+    }
+
+    return buffer_set_verify(set.get(), stdout);
+}
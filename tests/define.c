@@ -0,0 +1,144 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set_define.h>
+#include "buffer_set_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+BUFFER_SET_DEFINE(int_set, int, (*a > *b) - (*a < *b))
+
+#define COUNT 1000
+
+static size_t int_hash(const void * value, void * thunk)
+{
+    (void) thunk;
+    return ((size_t) *((const int*) value) * 2654435761u);
+}
+
+// Sets with a hash index are looked up through the index by the library.
+static int _define_hash()
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_set_compar;
+    options.hash = &int_hash;
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    int ret = 0;
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        int inserted;
+        if (int_set_insert(buffer_set, &idx, &inserted) == NULL)
+            ret = -1;
+    }
+    for (int idx=0; idx<COUNT; idx+=2)
+        int_set_erase(buffer_set, &idx);
+
+    for (int idx=0; (ret == 0) && (idx<COUNT); idx++)
+    {
+        const int * ptr = int_set_get(buffer_set, &idx);
+        if ((idx % 2) ? (!ptr || (*ptr != idx)) : (ptr != NULL))
+        {
+            printf("int_set_get() returned unexpected result for %d with the hash index", idx);
+            ret = -1;
+        }
+    }
+
+    if ((ret == 0) && (buffer_set_verify(buffer_set, stdout) != 0))
+        ret = -1;
+    buffer_set_destroy(buffer_set);
+    return ret;
+}
+
+int define()
+{
+    buffer_set_t * buffer_set = int_set_create(0);
+    if (buffer_set == NULL)
+    {
+        printf("int_set_create() failed");
+        return -1;
+    }
+
+    int ret = 0;
+
+    // insert in a scrambled order to get rotations on both sides
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        const int value = ((idx * 7919) % COUNT);
+        int inserted;
+        int * ptr = int_set_insert(buffer_set, &value, &inserted);
+        if (!ptr || !inserted || (*ptr != value))
+        {
+            printf("int_set_insert() failed for %d", value);
+            ret = -1;
+            break;
+        }
+    }
+
+    for (int idx=0; (ret == 0) && (idx<COUNT); idx+=2)
+    {
+        int inserted;
+        int * ptr = int_set_insert(buffer_set, &idx, &inserted);
+        if (!ptr || inserted)
+        {
+            printf("int_set_insert() unexpectedly inserted duplicate %d", idx);
+            ret = -1;
+        }
+        else if (int_set_erase(buffer_set, &idx) != ptr)
+        {
+            printf("int_set_erase() failed for %d", idx);
+            ret = -1;
+        }
+    }
+
+    for (int idx=0; (ret == 0) && (idx<COUNT); idx++)
+    {
+        const int * ptr = int_set_get(buffer_set, &idx);
+        buffer_set_iterator_t * it = int_set_find(buffer_set, &idx);
+        if ((idx % 2) ? (!ptr || (*ptr != idx)) : (ptr != NULL))
+        {
+            printf("int_set_get() returned unexpected result for %d", idx);
+            ret = -1;
+        }
+        else if ((it == buffer_set_end(buffer_set)) ? (ptr != NULL) : (buffer_set_get_at(buffer_set, it) != ptr))
+        {
+            printf("int_set_find() returned unexpected result for %d", idx);
+            ret = -1;
+        }
+    }
+
+    if ((ret == 0) && (buffer_set_get_size(buffer_set) != COUNT/2))
+    {
+        printf("unexpected size %u", (unsigned int) buffer_set_get_size(buffer_set));
+        ret = -1;
+    }
+
+    if ((ret == 0) && (buffer_set_verify(buffer_set, stdout) != 0))
+        ret = -1;
+
+    buffer_set_destroy(buffer_set);
+
+    if (ret == 0)
+        ret = _define_hash();
+    return ret;
+}
@@ -0,0 +1,154 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define RANGE 300
+#define OPS 5000
+
+struct value_s
+{
+    int key;
+    int qty;
+};
+
+static int value_cmp(const void * v1, const void * v2, void * thunk)
+{
+    const struct value_s * value1 = v1;
+    const struct value_s * value2 = v2;
+    return (value1->key > value2->key) - (value1->key < value2->key);
+}
+
+static void value_aggregate(void * aggregate, const void * value, const void * left, const void * right, void * thunk)
+{
+    int * sum = aggregate;
+    *sum = ((const struct value_s*) value)->qty;
+    if (left)
+        *sum += *((const int*) left);
+    if (right)
+        *sum += *((const int*) right);
+}
+
+static void value_init(void * value, const void * key, void * ctx)
+{
+    struct value_s * new_value = value;
+    new_value->key = ((const struct value_s*) key)->key;
+    new_value->qty = 0;
+    (*((int*) ctx))++;
+}
+
+static void value_merge(void * value, const void * other, void * ctx)
+{
+    ((struct value_s*) value)->qty += ((const struct value_s*) other)->qty;
+    (*((int*) ctx))++;
+}
+
+static int _emplace(int with_aggregate)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(struct value_s);
+    options.compar = &value_cmp;
+    if (with_aggregate)
+    {
+        options.aggregate_size = sizeof(int);
+        options.aggregate = &value_aggregate;
+    }
+
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    int qty[RANGE];
+    memset(qty, 0, sizeof(qty));
+    int inits = 0;
+    int merges = 0;
+    int expected_inits = 0;
+    int expected_merges = 0;
+    int rc = 0;
+    srand(3);
+    for (int op=0; (rc == 0) && (op<OPS); op++)
+    {
+        // the set grows while the values are constructed
+        struct value_s value;
+        value.key = (rand() % RANGE);
+        value.qty = (rand() % 100) + 1;
+        struct value_s * ptr;
+        if (op & 1)
+        {
+            expected_inits += (qty[value.key] == 0);
+            ptr = buffer_set_emplace(buffer_set, &value, &value_init, &inits);
+            if (ptr)
+            {
+                ptr->qty += value.qty;
+                // the aggregate is recalculated by the caller after updating the value in place
+                if (with_aggregate)
+                    buffer_set_update_aggregate(buffer_set, buffer_set_find(buffer_set, ptr));
+            }
+        }
+        else
+        {
+            expected_merges += (qty[value.key] != 0);
+            ptr = buffer_set_upsert(buffer_set, &value, &value_merge, &merges);
+        }
+
+        qty[value.key] += value.qty;
+        if ((ptr == NULL) || (ptr->key != value.key) || (ptr->qty != qty[value.key]))
+        {
+            fprintf(stderr, "unexpected value for the key %d\n", value.key);
+            rc = -1;
+        }
+    }
+
+    if ((rc == 0) && ((inits != expected_inits) || (merges != expected_merges)))
+    {
+        fprintf(stderr, "unexpected number of init (%d) or merge (%d) calls\n", inits, merges);
+        rc = -1;
+    }
+
+    if ((rc == 0) && with_aggregate)
+    {
+        int sum = 0;
+        for (int idx=0; idx<RANGE; idx++)
+            sum += qty[idx];
+        const int * aggregate = buffer_set_get_aggregate(buffer_set, buffer_set_root(buffer_set));
+        if (*aggregate != sum)
+        {
+            fprintf(stderr, "unexpected aggregate %d instead of %d\n", *aggregate, sum);
+            rc = -1;
+        }
+    }
+
+    if ((rc == 0) && (buffer_set_verify(buffer_set, stderr) != 0))
+        rc = -1;
+
+    buffer_set_destroy(buffer_set);
+    return rc;
+}
+
+int emplace()
+{
+    if (_emplace(0) != 0)
+        return -1;
+    if (_emplace(1) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define RANGE 4000
+
+static int _is_expired(const void * value, void * ctx)
+{
+    // every third value and the values above the limit
+    const int v = *((const int*) value);
+    return ((v % 3) == 0) || (v >= *((const int*) ctx));
+}
+
+static int _check(buffer_set_t * buffer_set, const unsigned char * present)
+{
+    buffer_set_size_t size = 0;
+    for (int value=0; value<RANGE; value++)
+    {
+        size += present[value];
+        if ((buffer_set_get(buffer_set, &value) != NULL) != present[value])
+        {
+            fprintf(stderr, "value %d is unexpectedly %s\n", value, present[value] ? "missing" : "present");
+            return -1;
+        }
+    }
+    if (buffer_set_get_size(buffer_set) != size)
+    {
+        fprintf(stderr, "unexpected set size\n");
+        return -1;
+    }
+    return buffer_set_verify(buffer_set, stderr);
+}
+
+static int _erase_range(unsigned int flags)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_cmp;
+    options.flags = flags;
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    unsigned char present[RANGE];
+    for (int idx=0; idx<RANGE; idx++)
+    {
+        int inserted;
+        const int value = ((idx * 7) % RANGE);
+        int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        *ptr = value;
+        present[value] = 1;
+    }
+
+    // small ranges are erased one by one, large ones rebuild the tree
+    const int ranges[][2] = { { 10, 20 }, { 15, 15 }, { 100, 1100 }, { -1, 50 }, { 3900, -1 } };
+    int rc = 0;
+    for (size_t idx=0; (rc == 0) && (idx<(sizeof(ranges) / sizeof(ranges[0]))); idx++)
+    {
+        const int lo = ranges[idx][0];
+        const int hi = ranges[idx][1];
+        buffer_set_size_t expected = 0;
+        for (int value=((lo < 0) ? 0 : lo); value<((hi < 0) ? RANGE : hi); value++)
+        {
+            expected += present[value];
+            present[value] = 0;
+        }
+        const buffer_set_size_t erased = buffer_set_erase_range(
+            buffer_set, (lo < 0) ? NULL : &lo, (hi < 0) ? NULL : &hi);
+        if (erased != expected)
+        {
+            fprintf(stderr, "erased %d values instead of %d from [%d, %d)\n", (int) erased, (int) expected, lo, hi);
+            rc = -1;
+        }
+        else
+            rc = _check(buffer_set, present);
+    }
+
+    const int limit = 3000;
+    buffer_set_size_t expected = 0;
+    for (int value=0; value<RANGE; value++)
+    {
+        if (present[value] && _is_expired(&value, (void*) &limit))
+        {
+            present[value] = 0;
+            expected++;
+        }
+    }
+    if ((rc == 0) && (buffer_set_erase_if(buffer_set, &_is_expired, (void*) &limit) != expected))
+    {
+        fprintf(stderr, "unexpected number of values erased by the predicate\n");
+        rc = -1;
+    }
+    if (rc == 0)
+        rc = _check(buffer_set, present);
+
+    // erased nodes are reused
+    for (int value=0; (rc == 0) && (value<RANGE); value+=2)
+    {
+        int inserted;
+        int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        if (ptr == NULL)
+            rc = -1;
+        else if (inserted)
+            *ptr = value;
+        present[value] = 1;
+    }
+    if (rc == 0)
+        rc = _check(buffer_set, present);
+    if ((rc == 0) && (buffer_set_erase_if(buffer_set, &_is_expired, (void*) &limit) == 0))
+        rc = -1;
+
+    buffer_set_destroy(buffer_set);
+    return rc;
+}
+
+int erase_range()
+{
+    if (_erase_range(0) != 0)
+        return -1;
+    if (_erase_range(BUFFER_SET_ORDER_STATISTICS) != 0)
+        return -1;
+    if (_erase_range(BUFFER_SET_SPLIT_VALUES) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+static int _frozen(int count)
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    // odd values 1, 3, ..., 2 * count - 1
+    for (int idx=0; idx<count; idx++)
+    {
+        int inserted;
+        const int value = (((idx * 7) % count) * 2 + 1);
+        int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        *ptr = value;
+    }
+
+    buffer_set_frozen_t * frozen = buffer_set_freeze(buffer_set);
+    // the frozen set does not depend on the set
+    buffer_set_destroy(buffer_set);
+    if (frozen == NULL)
+    {
+        printf("buffer_set_freeze() failed");
+        return -1;
+    }
+
+    int rc = 0;
+    if ((int) buffer_set_frozen_get_size(frozen) != count)
+    {
+        fprintf(stderr, "unexpected frozen set size\n");
+        rc = -1;
+    }
+
+    for (int value=0; (rc == 0) && (value<=(count * 2)); value++)
+    {
+        const int * ptr = buffer_set_frozen_get(frozen, &value);
+        const int found = (value & 1);
+        if ((ptr != NULL) != found)
+        {
+            fprintf(stderr, "value %d is unexpectedly %s\n", value, ptr ? "found" : "not found");
+            rc = -1;
+        }
+        else if (ptr && (*ptr != value))
+        {
+            fprintf(stderr, "got %d instead of %d\n", *ptr, value);
+            rc = -1;
+        }
+
+        const int * lower_bound = buffer_set_frozen_lower_bound(frozen, &value);
+        const int expected = (value | 1);
+        if (expected < (count * 2))
+        {
+            if ((lower_bound == NULL) || (*lower_bound != expected))
+            {
+                fprintf(stderr, "unexpected lower bound for %d\n", value);
+                rc = -1;
+            }
+        }
+        else if (lower_bound != NULL)
+        {
+            fprintf(stderr, "unexpected lower bound %d for %d\n", *lower_bound, value);
+            rc = -1;
+        }
+    }
+
+    buffer_set_frozen_destroy(frozen);
+    return rc;
+}
+
+int frozen()
+{
+    // empty, complete and incomplete implicit trees
+    if (_frozen(0) != 0)
+        return -1;
+    if (_frozen(1) != 0)
+        return -1;
+    if (_frozen(15) != 0)
+        return -1;
+    if (_frozen(1000) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+static buffer_set_size_t grow_double(buffer_set_size_t capacity, void * thunk)
+{
+    (void) thunk;
+    return (capacity * 2);
+}
+
+static int _growth(const buffer_set_options_t * options, const buffer_set_size_t * expected, int count)
+{
+    buffer_set_t * buffer_set = buffer_set_create_ex(options);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    int rc = 0;
+    int value = 0;
+    for (int idx=0; idx<count; idx++)
+    {
+        // fill the set until the capacity changes
+        const buffer_set_size_t capacity = buffer_set_get_capacity(buffer_set);
+        while (buffer_set_get_capacity(buffer_set) == capacity)
+        {
+            int inserted;
+            int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+            *ptr = value++;
+        }
+
+        if (buffer_set_get_capacity(buffer_set) != expected[idx])
+        {
+            fprintf(stderr, "capacity %u, expected %u\n",
+                (unsigned int) buffer_set_get_capacity(buffer_set), (unsigned int) expected[idx]);
+            rc = -1;
+            break;
+        }
+    }
+
+    if ((rc == 0) && (buffer_set_verify(buffer_set, stderr) != 0))
+        rc = -1;
+
+    buffer_set_destroy(buffer_set);
+    return rc;
+}
+
+int growth()
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_cmp;
+
+    // 1.5x by default
+    const buffer_set_size_t geometric[] = { 16, 24, 36, 54, 81 };
+    if (_growth(&options, geometric, 5) != 0)
+        return -1;
+
+    options.growth_factor = 300;
+    const buffer_set_size_t triple[] = { 16, 48, 144 };
+    if (_growth(&options, triple, 3) != 0)
+        return -1;
+
+    options.growth_factor = 0;
+    options.growth_step = 100;
+    options.initial_capacity = 100;
+    const buffer_set_size_t step[] = { 200, 300, 400 };
+    if (_growth(&options, step, 3) != 0)
+        return -1;
+    options.initial_capacity = 0;
+
+    options.growth_step = 0;
+    options.grow = &grow_double;
+    const buffer_set_size_t doubling[] = { 16, 32, 64, 128 };
+    if (_growth(&options, doubling, 4) != 0)
+        return -1;
+
+    options.grow = NULL;
+    options.growth_factor = 100;
+    errno = 0;
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if ((buffer_set != NULL) || (errno != EINVAL))
+    {
+        fprintf(stderr, "growth factor 100 should be rejected\n");
+        if (buffer_set)
+            buffer_set_destroy(buffer_set);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define RANGE 5000
+
+static size_t int_hash(const void * value, void * thunk)
+{
+    const unsigned int v = *((const unsigned int*) value);
+    return (size_t) (v * 2654435761u);
+}
+
+static size_t bad_hash(const void * value, void * thunk)
+{
+    // long collision chains exercise the backward shift deletion
+    return (size_t) (*((const int*) value) % 7);
+}
+
+static int _check(buffer_set_t * buffer_set, const char * present)
+{
+    if (buffer_set_verify(buffer_set, stderr) != 0)
+        return -1;
+    for (int value=0; value<RANGE; value++)
+    {
+        const int * ptr = buffer_set_get(buffer_set, &value);
+        if ((ptr != NULL) != (present[value] != 0))
+        {
+            fprintf(stderr, "value %d is unexpectedly %s\n", value, ptr ? "found" : "not found");
+            return -1;
+        }
+        if (ptr && (*ptr != value))
+        {
+            fprintf(stderr, "got %d instead of %d\n", *ptr, value);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int _hash_index(size_t (*hash)(const void *, void *), unsigned int flags, int range)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_cmp;
+    options.flags = flags;
+    options.hash = hash;
+
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    char * present = calloc(RANGE, 1);
+    if ((buffer_set == NULL) || (present == NULL))
+    {
+        printf("not enough memory");
+        if (buffer_set)
+            buffer_set_destroy(buffer_set);
+        free(present);
+        return -1;
+    }
+
+    int rc = 0;
+    unsigned int seed = 777;
+    const int ops = (range * 6);
+    for (int op=0; (rc == 0) && (op<ops); op++)
+    {
+        seed = (seed * 1103515245 + 12345);
+        const int value = (int) ((seed >> 8) % range);
+        const int insert = ((seed >> 4) % 8) < ((op < (ops / 2)) ? 5 : 2);
+        if (insert)
+        {
+            int inserted;
+            int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+            *ptr = value;
+            present[value] = 1;
+        }
+        else if (buffer_set_erase(buffer_set, &value))
+            present[value] = 0;
+
+        if ((op % (ops / 10)) == 0)
+        {
+            if (op > (ops / 2))
+                buffer_set_shrink(buffer_set);
+            rc = _check(buffer_set, present);
+        }
+    }
+
+    if (rc == 0)
+    {
+        int values[50];
+        memset(present, 0, RANGE);
+        for (int idx=0; idx<50; idx++)
+        {
+            values[idx] = (idx * 5);
+            present[idx * 5] = 1;
+        }
+        if (buffer_set_build_sorted(buffer_set, values, 50) != 0)
+            rc = -1;
+        else
+            rc = _check(buffer_set, present);
+    }
+
+    if (rc == 0)
+    {
+        buffer_set_clear(buffer_set);
+        memset(present, 0, RANGE);
+        rc = _check(buffer_set, present);
+    }
+
+    buffer_set_destroy(buffer_set);
+    free(present);
+    return rc;
+}
+
+int hash_index()
+{
+    if (_hash_index(&int_hash, 0, RANGE) != 0)
+        return -1;
+    if (_hash_index(&int_hash, BUFFER_SET_SPLIT_VALUES | BUFFER_SET_ORDER_STATISTICS, RANGE) != 0)
+        return -1;
+    if (_hash_index(&bad_hash, 0, 500) != 0)
+        return -1;
+    return 0;
+}
@@ -14,13 +14,18 @@
  */
 
 #include <buffer_set/buffer_set.h>
+#include <buffer_set/buffer_set_define.h>
+#include "buffer_set_internal.h"
 #include <stdlib.h>
+#include <string.h>
 
 #if defined(_WIN32)
 #include <Windows.h>
 #endif
 
 #define COUNT (50*1000)
+#define FIND_COUNT (1000*1000)
+#define SMALL_COUNT 1000
 
 static unsigned int elapsed_time(
     const struct timeval * start,
@@ -88,18 +93,106 @@ static int buffer_set_cmp(const void * pv1, const void * pv2, void * thunk)
         return 0;
 }
 
-static unsigned int test_buffer_set()
+static size_t buffer_set_hash(const void * pv, void * thunk)
+{
+    return (size_t) (*((const unsigned int*) pv) * 2654435761u);
+}
+
+static unsigned int test_buffer_set(size_t (*hash)(const void *, void *), unsigned int * find_time)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.initial_capacity = COUNT+1;
+    options.compar = &buffer_set_cmp;
+    options.hash = hash;
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if (buffer_set == NULL)
+    {
+        printf("not enough memory");
+        return 0;
+    }
+
+    struct timeval tv_start;
+    gettimeofday(&tv_start, NULL);
+
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        int inserted;
+        void * ptr = buffer_set_insert(buffer_set, &idx, &inserted);
+        *((int*)ptr) = idx;
+    }
+
+    struct timeval tv_end;
+    gettimeofday(&tv_end, NULL);
+
+    unsigned int found = 0;
+    for (int idx=0; idx<FIND_COUNT; idx++)
+    {
+        const int value = (int) ((idx * 40503u) % COUNT);
+        found += (buffer_set_get(buffer_set, &value) != NULL);
+    }
+
+    struct timeval tv_find_end;
+    gettimeofday(&tv_find_end, NULL);
+    *find_time = elapsed_time(&tv_end, &tv_find_end);
+
+    buffer_set_destroy(buffer_set);
+
+    return (found == FIND_COUNT) ? elapsed_time(&tv_start, &tv_end) : 0;
+}
+
+static unsigned int test_buffer_set_frozen()
 {
     buffer_set_t * buffer_set = buffer_set_create(sizeof(int), COUNT+1, &buffer_set_cmp, NULL, NULL);
     if (buffer_set == NULL)
     {
         printf("not enough memory");
-        return -1;
+        return 0;
+    }
+
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        int inserted;
+        void * ptr = buffer_set_insert(buffer_set, &idx, &inserted);
+        *((int*)ptr) = idx;
+    }
+
+    buffer_set_frozen_t * frozen = buffer_set_freeze(buffer_set);
+    buffer_set_destroy(buffer_set);
+    if (frozen == NULL)
+    {
+        printf("not enough memory");
+        return 0;
     }
 
     struct timeval tv_start;
     gettimeofday(&tv_start, NULL);
 
+    unsigned int found = 0;
+    for (int idx=0; idx<FIND_COUNT; idx++)
+    {
+        const int value = (int) ((idx * 40503u) % COUNT);
+        found += (buffer_set_frozen_get(frozen, &value) != NULL);
+    }
+
+    struct timeval tv_end;
+    gettimeofday(&tv_end, NULL);
+
+    buffer_set_frozen_destroy(frozen);
+
+    return (found == FIND_COUNT) ? elapsed_time(&tv_start, &tv_end) : 0;
+}
+
+static unsigned int test_buffer_set_int_index()
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), COUNT+1, &buffer_set_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("not enough memory");
+        return 0;
+    }
+
     for (int idx=0; idx<COUNT; idx++)
     {
         int inserted;
@@ -107,17 +200,135 @@ static unsigned int test_buffer_set()
         *((int*)ptr) = idx;
     }
 
+    buffer_set_int_index_t * index = buffer_set_int_index_create(buffer_set, BUFFER_SET_KEY_INT32, 0);
+    buffer_set_destroy(buffer_set);
+    if (index == NULL)
+    {
+        printf("not enough memory");
+        return 0;
+    }
+
+    struct timeval tv_start;
+    gettimeofday(&tv_start, NULL);
+
+    unsigned int found = 0;
+    for (int idx=0; idx<FIND_COUNT; idx++)
+    {
+        const int value = (int) ((idx * 40503u) % COUNT);
+        found += (buffer_set_int_index_get(index, &value) != NULL);
+    }
+
     struct timeval tv_end;
     gettimeofday(&tv_end, NULL);
 
+    buffer_set_int_index_destroy(index);
+
+    return (found == FIND_COUNT) ? elapsed_time(&tv_start, &tv_end) : 0;
+}
+
+BUFFER_SET_DEFINE(int_set, int, (*a > *b) - (*a < *b))
+
+static unsigned int test_buffer_set_define(unsigned int * find_time)
+{
+    buffer_set_t * buffer_set = int_set_create(COUNT+1);
+    if (buffer_set == NULL)
+    {
+        printf("not enough memory");
+        return 0;
+    }
+
+    struct timeval tv_start;
+    gettimeofday(&tv_start, NULL);
+
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        int inserted;
+        int_set_insert(buffer_set, &idx, &inserted);
+    }
+
+    struct timeval tv_end;
+    gettimeofday(&tv_end, NULL);
+
+    unsigned int found = 0;
+    for (int idx=0; idx<FIND_COUNT; idx++)
+    {
+        const int value = (int) ((idx * 40503u) % COUNT);
+        found += (int_set_get(buffer_set, &value) != NULL);
+    }
+
+    struct timeval tv_find_end;
+    gettimeofday(&tv_find_end, NULL);
+    *find_time = elapsed_time(&tv_end, &tv_find_end);
+
     buffer_set_destroy(buffer_set);
 
-    return elapsed_time(&tv_start, &tv_end);
+    return (found == FIND_COUNT) ? elapsed_time(&tv_start, &tv_end) : 0;
+}
+
+// The set fits the CPU cache, so the lookups are not bound by the memory latency
+// and the cost of the comparison function calls is visible.
+static unsigned int test_small_set(int use_define)
+{
+    buffer_set_t * buffer_set = use_define ? int_set_create(SMALL_COUNT) :
+        buffer_set_create(sizeof(int), SMALL_COUNT, &buffer_set_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("not enough memory");
+        return 0;
+    }
+
+    for (int idx=0; idx<SMALL_COUNT; idx++)
+    {
+        int inserted;
+        void * ptr = buffer_set_insert(buffer_set, &idx, &inserted);
+        *((int*)ptr) = idx;
+    }
+
+    struct timeval tv_start;
+    gettimeofday(&tv_start, NULL);
+
+    unsigned int found = 0;
+    if (use_define)
+    {
+        for (int idx=0; idx<FIND_COUNT; idx++)
+        {
+            const int value = (int) ((idx * 40503u) % SMALL_COUNT);
+            found += (int_set_get(buffer_set, &value) != NULL);
+        }
+    }
+    else
+    {
+        for (int idx=0; idx<FIND_COUNT; idx++)
+        {
+            const int value = (int) ((idx * 40503u) % SMALL_COUNT);
+            found += (buffer_set_get(buffer_set, &value) != NULL);
+        }
+    }
+
+    struct timeval tv_end;
+    gettimeofday(&tv_end, NULL);
+
+    buffer_set_destroy(buffer_set);
+
+    return (found == FIND_COUNT) ? elapsed_time(&tv_start, &tv_end) : 0;
 }
 
 int main(int argc, const char * argv[])
 {
-    printf("buffer_set: inserted values [0...%u] @ %u usec\n", COUNT-1, test_buffer_set());
+    unsigned int find_time = 0;
+    unsigned int insert_time = test_buffer_set(NULL, &find_time);
+    printf("buffer_set: inserted values [0...%u] @ %u usec\n", COUNT-1, insert_time);
+    printf("buffer_set: %u lookups @ %u usec\n", FIND_COUNT, find_time);
+    insert_time = test_buffer_set(&buffer_set_hash, &find_time);
+    printf("buffer_set with hash index: inserted values [0...%u] @ %u usec\n", COUNT-1, insert_time);
+    printf("buffer_set with hash index: %u lookups @ %u usec\n", FIND_COUNT, find_time);
+    printf("frozen buffer_set: %u lookups @ %u usec\n", FIND_COUNT, test_buffer_set_frozen());
+    printf("integer key index: %u lookups @ %u usec\n", FIND_COUNT, test_buffer_set_int_index());
+    insert_time = test_buffer_set_define(&find_time);
+    printf("BUFFER_SET_DEFINE: inserted values [0...%u] @ %u usec\n", COUNT-1, insert_time);
+    printf("BUFFER_SET_DEFINE: %u lookups @ %u usec\n", FIND_COUNT, find_time);
+    printf("buffer_set: %u lookups in %u values @ %u usec\n", FIND_COUNT, SMALL_COUNT, test_small_set(0));
+    printf("BUFFER_SET_DEFINE: %u lookups in %u values @ %u usec\n", FIND_COUNT, SMALL_COUNT, test_small_set(1));
 #if !defined(_WIN32)
     printf("stdlib: inserted values [0...%u] @ %u usec\n", COUNT-1, test_stdlib());
 #endif
@@ -0,0 +1,177 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+struct record_s
+{
+    int tag;
+    uint64_t key;
+};
+
+static int _record_cmp(const void * v1, const void * v2, void * thunk)
+{
+    const uint64_t k1 = ((const struct record_s*) v1)->key;
+    const uint64_t k2 = ((const struct record_s*) v2)->key;
+    (void) thunk;
+    return (k1 > k2) - (k1 < k2);
+}
+
+static int _uint32_cmp(const void * v1, const void * v2, void * thunk)
+{
+    const uint32_t u1 = *((const uint32_t*) v1);
+    const uint32_t u2 = *((const uint32_t*) v2);
+    (void) thunk;
+    return (u1 > u2) - (u1 < u2);
+}
+
+static int _int_index32(int count, int key_type)
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int32_t), 0,
+        (key_type == BUFFER_SET_KEY_INT32) ? &int_cmp : &_uint32_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    // even values around zero, and the extreme ones for the signed
+    // and the unsigned order, including the padding key
+    int32_t values[4] = { INT32_MIN, INT32_MAX, -1, 0 };
+    for (int idx=0; idx<(count + 4); idx++)
+    {
+        int inserted;
+        const int32_t value = (idx < 4) ? values[idx] : ((((idx * 7) % count) - (count / 2)) * 2);
+        int32_t * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        *ptr = value;
+    }
+
+    buffer_set_int_index_t * index = buffer_set_int_index_create(buffer_set, key_type, 0);
+    if (index == NULL)
+    {
+        printf("buffer_set_int_index_create() failed");
+        buffer_set_destroy(buffer_set);
+        return -1;
+    }
+
+    int rc = 0;
+    for (int idx=-(count + 2); (rc == 0) && (idx<=(count + 6)); idx++)
+    {
+        const int32_t value = (idx <= (count + 2)) ? idx : values[idx - count - 3];
+        const int32_t * expected = buffer_set_get(buffer_set, &value);
+        const int32_t * ptr = buffer_set_int_index_get(index, &value);
+        if ((ptr != NULL) != (expected != NULL))
+        {
+            fprintf(stderr, "value %d is unexpectedly %s\n", value, ptr ? "found" : "not found");
+            rc = -1;
+        }
+        else if (ptr && (*ptr != value))
+        {
+            fprintf(stderr, "got %d instead of %d\n", *ptr, value);
+            rc = -1;
+        }
+    }
+
+    buffer_set_int_index_destroy(index);
+    buffer_set_destroy(buffer_set);
+    return rc;
+}
+
+static int _int_index64(int count, int with_max)
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(struct record_s), 0, &_record_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    // keys with the high bit set to check the unsigned order
+    for (int idx=0; idx<count; idx++)
+    {
+        int inserted;
+        struct record_s record;
+        record.tag = idx;
+        record.key = ((((uint64_t) idx * 7) % count) * 3) ^ (UINT64_C(1) << 63);
+        if (with_max && (idx == 0))
+            record.key = UINT64_MAX;
+        struct record_s * ptr = buffer_set_insert(buffer_set, &record, &inserted);
+        *ptr = record;
+    }
+
+    if (buffer_set_int_index_create(buffer_set, BUFFER_SET_KEY_UINT64, 4 * sizeof(int)) != NULL)
+    {
+        fprintf(stderr, "key out of the value is unexpectedly accepted\n");
+        buffer_set_destroy(buffer_set);
+        return -1;
+    }
+
+    buffer_set_int_index_t * index = buffer_set_int_index_create(
+        buffer_set, BUFFER_SET_KEY_UINT64, offsetof(struct record_s, key));
+    if (index == NULL)
+    {
+        printf("buffer_set_int_index_create() failed");
+        buffer_set_destroy(buffer_set);
+        return -1;
+    }
+
+    int rc = 0;
+    for (int idx=0; (rc == 0) && (idx<=(count * 3 + 1)); idx++)
+    {
+        struct record_s record;
+        record.key = (idx <= (count * 3)) ? ((uint64_t) idx ^ (UINT64_C(1) << 63)) : UINT64_MAX;
+        const struct record_s * expected = buffer_set_get(buffer_set, &record);
+        const struct record_s * ptr = buffer_set_int_index_get(index, &record.key);
+        if ((ptr != NULL) != (expected != NULL))
+        {
+            fprintf(stderr, "key %d is unexpectedly %s\n", idx, ptr ? "found" : "not found");
+            rc = -1;
+        }
+        else if (ptr && ((ptr->key != expected->key) || (ptr->tag != expected->tag)))
+        {
+            fprintf(stderr, "unexpected record for the key %d\n", idx);
+            rc = -1;
+        }
+    }
+
+    buffer_set_int_index_destroy(index);
+    buffer_set_destroy(buffer_set);
+    return rc;
+}
+
+int int_index()
+{
+    // single, complete and incomplete blocks
+    const int counts[] = { 1, 12, 16, 289, 1000, 5000 };
+    for (size_t idx=0; idx<(sizeof(counts) / sizeof(counts[0])); idx++)
+    {
+        if (_int_index32(counts[idx], BUFFER_SET_KEY_INT32) != 0)
+            return -1;
+        if (_int_index32(counts[idx], BUFFER_SET_KEY_UINT32) != 0)
+            return -1;
+        if (_int_index64(counts[idx], 0) != 0)
+            return -1;
+        if (_int_index64(counts[idx], 1) != 0)
+            return -1;
+    }
+    if (_int_index64(0, 0) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include "buffer_set/buffer_set.h"
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define COUNT 1000
+
+int iterator_prev()
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("not enough memory");
+        return -1;
+    }
+
+    int ret = 0;
+
+    if ((buffer_set_rbegin(buffer_set) != buffer_set_end(buffer_set)) || (buffer_set_last(buffer_set) != NULL))
+    {
+        printf("empty set expected to have no last value\n");
+        ret = -1;
+    }
+
+    for (int idx=1; idx<COUNT; idx++)
+    {
+        int inserted;
+        const int value = ((idx * 7) % COUNT);
+        void * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        if (!ptr)
+        {
+            printf("buffer_set_insert() unexpectedly returned NULL for %d", value);
+            ret = -1;
+            break;
+        }
+        *((int*)ptr) = value;
+    }
+
+    if (!ret)
+    {
+        const int * last = buffer_set_last(buffer_set);
+        if ((last == NULL) || (*last != (COUNT - 1)))
+        {
+            printf("unexpected last value\n");
+            ret = -1;
+        }
+    }
+
+    if (!ret)
+    {
+        int expected_value = (COUNT - 1);
+        buffer_set_iterator_t * it = buffer_set_rbegin(buffer_set);
+        buffer_set_iterator_t * it_end = buffer_set_end(buffer_set);
+        while (it != it_end)
+        {
+            const int value = * (const int*) buffer_set_get_at(buffer_set, it);
+            if (value != expected_value)
+            {
+                printf("got %d instead of %d\n", value, expected_value);
+                ret = -1;
+                break;
+            }
+            expected_value--;
+            it = buffer_set_iterator_prev(buffer_set, it);
+        }
+
+        if (!ret && (expected_value != 0))
+        {
+            printf("iteration stopped at %d\n", expected_value);
+            ret = -1;
+        }
+    }
+
+    if (!ret)
+    {
+        // prev of the end is the last value, next of it is the end again
+        buffer_set_iterator_t * it = buffer_set_iterator_prev(buffer_set, buffer_set_end(buffer_set));
+        if ((it != buffer_set_rbegin(buffer_set)) || (buffer_set_iterator_next(buffer_set, it) != buffer_set_end(buffer_set)))
+        {
+            printf("unexpected iterator at the end\n");
+            ret = -1;
+        }
+    }
+
+    buffer_set_destroy(buffer_set);
+
+    return ret;
+}
@@ -35,15 +35,39 @@ void int_printer(FILE * file, const void * value)
 }
 
 // Tests
+int aggregate();
+int allocator();
+int batch();
+int bounds();
+int build_sorted();
+int by_key();
 int clear();
+int concurrent_reads();
+int cursor();
+int cxx_wrapper();
+int define();
+int emplace();
+int erase_range();
+int frozen();
+int growth();
+int hash_index();
 int insert();
+int int_index();
 int iterator_next();
+int iterator_prev();
 int max_capacity();
+int optimize_layout();
+int order_statistics();
 int print_debug();
 int random_op();
 int realloc_move();
 int reg();
+int set_algebra();
+int sharded();
 int shrink();
+int snapshot();
+int split_join();
+int split_values();
 
 void run_test(int * failed_tests, const char * name, int (*test_func)())
 {
@@ -65,15 +89,39 @@ int main(int argc, const char * argv[])
 
 #define RUN_TEST(name) run_test(&failed_tests, #name, name); tests++
 
+    RUN_TEST(aggregate);
+    RUN_TEST(allocator);
+    RUN_TEST(batch);
+    RUN_TEST(bounds);
+    RUN_TEST(build_sorted);
+    RUN_TEST(by_key);
     RUN_TEST(clear);
+    RUN_TEST(concurrent_reads);
+    RUN_TEST(cursor);
+    RUN_TEST(cxx_wrapper);
+    RUN_TEST(define);
+    RUN_TEST(emplace);
+    RUN_TEST(erase_range);
+    RUN_TEST(frozen);
+    RUN_TEST(growth);
+    RUN_TEST(hash_index);
     RUN_TEST(insert);
+    RUN_TEST(int_index);
     RUN_TEST(iterator_next);
+    RUN_TEST(iterator_prev);
     RUN_TEST(max_capacity);
     RUN_TEST(realloc_move);
+    RUN_TEST(optimize_layout);
+    RUN_TEST(order_statistics);
     RUN_TEST(print_debug);
     RUN_TEST(random_op);
     RUN_TEST(reg);
+    RUN_TEST(set_algebra);
+    RUN_TEST(sharded);
     RUN_TEST(shrink);
+    RUN_TEST(snapshot);
+    RUN_TEST(split_join);
+    RUN_TEST(split_values);
 
 #undef RUN_TEST
 
@@ -18,6 +18,51 @@
 #include <string.h>
 #include "test.h"
 
+#if defined(BUFFER_SET_WIDE_INDEX)
+
+/* With 32-bit indices the set must grow past the 16-bit limit. */
+#define COUNT 0x18000
+
+int max_capacity()
+{
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    int ret = 0;
+
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        int inserted;
+        void * ptr = buffer_set_insert(buffer_set, &idx, &inserted);
+        if (!ptr)
+        {
+            printf("buffer_set_insert() unexpectedly returned NULL for %d", idx);
+            ret = -1;
+            break;
+        }
+        *((int*)ptr) = idx;
+    }
+
+    if ((ret == 0) && (buffer_set_get_size(buffer_set) != COUNT))
+    {
+        printf("unexpected size %u", (unsigned int) buffer_set_get_size(buffer_set));
+        ret = -1;
+    }
+
+    if ((ret == 0) && (buffer_set_verify(buffer_set, stdout) != 0))
+        ret = -1;
+
+    buffer_set_destroy(buffer_set);
+
+    return ret;
+}
+
+#else
+
 int max_capacity()
 {
     buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
@@ -55,3 +100,5 @@ int max_capacity()
 
     return ret;
 }
+
+#endif
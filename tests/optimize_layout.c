@@ -0,0 +1,161 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define COUNT 3000
+
+static void value_move(void * dst, void * src, void * thunk)
+{
+    memcpy(dst, src, sizeof(int));
+}
+
+static size_t int_hash(const void * value, void * thunk)
+{
+    return (size_t) (*((const unsigned int*) value) * 2654435761u);
+}
+
+static int _check(buffer_set_t * buffer_set, ptrdiff_t * offsets)
+{
+    // Checks the content of the set, stores offsets of the values
+    // from the root value or compares them to the stored ones.
+    if (buffer_set_verify(buffer_set, stderr) != 0)
+        return -1;
+
+    const char * root_value = buffer_set_get_at(buffer_set, buffer_set_root(buffer_set));
+    int expected = 1;
+    int count = 0;
+    buffer_set_iterator_t * it = buffer_set_begin(buffer_set);
+    while (it != buffer_set_end(buffer_set))
+    {
+        const int * value = buffer_set_get_at(buffer_set, it);
+        if (*value != expected)
+        {
+            fprintf(stderr, "got %d instead of %d\n", *value, expected);
+            return -1;
+        }
+        // the root is the first node
+        const ptrdiff_t offset = (((const char*) value) - root_value);
+        if (offset < 0)
+        {
+            fprintf(stderr, "value %d is located before the root\n", *value);
+            return -1;
+        }
+        if (offsets[count] == -1)
+            offsets[count] = offset;
+        else if (offsets[count] != offset)
+        {
+            fprintf(stderr, "layout of the value %d changed\n", *value);
+            return -1;
+        }
+        if (buffer_set_get(buffer_set, value) != value)
+        {
+            fprintf(stderr, "value %d not found\n", *value);
+            return -1;
+        }
+        expected += 2;
+        count++;
+        it = buffer_set_iterator_next(buffer_set, it);
+    }
+    return 0;
+}
+
+static int _optimize_layout(unsigned int flags, int use_move, int use_hash)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_cmp;
+    options.move = use_move ? &value_move : NULL;
+    options.hash = use_hash ? &int_hash : NULL;
+    options.flags = flags;
+
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    ptrdiff_t * offsets = malloc(sizeof(ptrdiff_t) * COUNT);
+    if ((buffer_set == NULL) || (offsets == NULL))
+    {
+        printf("not enough memory");
+        if (buffer_set)
+            buffer_set_destroy(buffer_set);
+        free(offsets);
+        return -1;
+    }
+
+    if (buffer_set_optimize_layout(buffer_set) != 0)
+    {
+        fprintf(stderr, "buffer_set_optimize_layout() failed for an empty set\n");
+        buffer_set_destroy(buffer_set);
+        free(offsets);
+        return -1;
+    }
+
+    // insert in a scattered order, erase even values
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        int inserted;
+        const int value = ((idx * 1237) % COUNT);
+        int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        *ptr = value;
+    }
+    for (int value=0; value<COUNT; value+=2)
+        buffer_set_erase(buffer_set, &value);
+
+    int rc = 0;
+    for (int idx=0; idx<COUNT; idx++)
+        offsets[idx] = -1;
+
+    // the second call should not change the layout
+    for (int pass=0; (rc == 0) && (pass<2); pass++)
+    {
+        if (buffer_set_optimize_layout(buffer_set) != 0)
+            rc = -1;
+        else
+            rc = _check(buffer_set, offsets);
+    }
+
+    if (rc == 0)
+    {
+        // the set is still modifiable
+        for (int value=0; value<COUNT; value+=2)
+        {
+            int inserted;
+            int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+            *ptr = value;
+        }
+        if ((buffer_set_get_size(buffer_set) != COUNT) || (buffer_set_verify(buffer_set, stderr) != 0))
+        {
+            fprintf(stderr, "set is broken after the layout optimization\n");
+            rc = -1;
+        }
+    }
+
+    buffer_set_destroy(buffer_set);
+    free(offsets);
+    return rc;
+}
+
+int optimize_layout()
+{
+    if (_optimize_layout(0, 0, 0) != 0)
+        return -1;
+    if (_optimize_layout(BUFFER_SET_SPLIT_VALUES | BUFFER_SET_ORDER_STATISTICS, 0, 1) != 0)
+        return -1;
+    if (_optimize_layout(0, 1, 0) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define RANGE 3000
+#define OPS 20000
+
+static void value_move(void * dst, void * src, void * thunk)
+{
+    memcpy(dst, src, sizeof(int));
+}
+
+static int _check(buffer_set_t * buffer_set, const char * present)
+{
+    if (buffer_set_verify(buffer_set, stderr) != 0)
+        return -1;
+
+    buffer_set_size_t rank = 0;
+    for (int value=0; value<RANGE; value++)
+    {
+        if (buffer_set_rank(buffer_set, &value) != rank)
+        {
+            fprintf(stderr, "unexpected rank %u of %d, expected %u\n",
+                (unsigned int) buffer_set_rank(buffer_set, &value), value, (unsigned int) rank);
+            return -1;
+        }
+        if (present[value])
+        {
+            const int * ptr = buffer_set_select(buffer_set, rank);
+            if ((ptr == NULL) || (*ptr != value))
+            {
+                fprintf(stderr, "unexpected value selected at %u\n", (unsigned int) rank);
+                return -1;
+            }
+            rank++;
+        }
+    }
+
+    if (buffer_set_select(buffer_set, rank) != NULL)
+    {
+        fprintf(stderr, "select out of range returned a value\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int _order_statistics(unsigned int flags, int use_move)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_cmp;
+    options.move = use_move ? &value_move : NULL;
+    options.flags = flags;
+
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    char * present = calloc(RANGE, 1);
+    if ((buffer_set == NULL) || (present == NULL))
+    {
+        printf("not enough memory");
+        if (buffer_set)
+            buffer_set_destroy(buffer_set);
+        free(present);
+        return -1;
+    }
+
+    int rc = 0;
+    unsigned int seed = 12345;
+    for (int op=0; (rc == 0) && (op<OPS); op++)
+    {
+        seed = (seed * 1103515245 + 12345);
+        const int value = (int) ((seed >> 8) % RANGE);
+        // insert more than erase first, then erase more to shrink the set
+        const int insert = ((seed >> 4) % 8) < ((op < (OPS / 2)) ? 5 : 2);
+        if (insert)
+        {
+            int inserted;
+            int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+            *ptr = value;
+            present[value] = 1;
+        }
+        else if (buffer_set_erase(buffer_set, &value))
+            present[value] = 0;
+
+        if ((op % 2000) == 1999)
+        {
+            if (op > (OPS / 2))
+                buffer_set_shrink(buffer_set);
+            rc = _check(buffer_set, present);
+        }
+    }
+
+    if (rc == 0)
+    {
+        // balanced build sets the subtree sizes as well
+        int values[100];
+        memset(present, 0, RANGE);
+        for (int idx=0; idx<100; idx++)
+        {
+            values[idx] = (idx * 3);
+            present[idx * 3] = 1;
+        }
+        if (buffer_set_build_sorted(buffer_set, values, 100) != 0)
+            rc = -1;
+        else
+            rc = _check(buffer_set, present);
+    }
+
+    buffer_set_destroy(buffer_set);
+    free(present);
+    return rc;
+}
+
+int order_statistics()
+{
+    if (_order_statistics(BUFFER_SET_ORDER_STATISTICS, 0) != 0)
+        return -1;
+    if (_order_statistics(BUFFER_SET_ORDER_STATISTICS | BUFFER_SET_SPLIT_VALUES, 0) != 0)
+        return -1;
+    if (_order_statistics(BUFFER_SET_ORDER_STATISTICS, 1) != 0)
+        return -1;
+    // without the augmentation rank and select walk the set
+    if (_order_statistics(0, 0) != 0)
+        return -1;
+    return 0;
+}
@@ -213,7 +213,7 @@ int random_op()
 
     buffer_set_t * buffer_set = buffer_set_create(
         sizeof(int),
-        (uint16_t) MAX_ELEMENTS/4,
+        (buffer_set_size_t) MAX_ELEMENTS/4,
         &int_cmp,
         NULL,
         NULL
@@ -263,7 +263,7 @@ int random_op()
 
             if (!max_elements_reached)
             {
-                const uint16_t buffer_set_size = buffer_set_get_size(buffer_set);
+                const buffer_set_size_t buffer_set_size = buffer_set_get_size(buffer_set);
                 max_elements_reached = (buffer_set_size == MAX_ELEMENTS);
             }
 
@@ -301,7 +301,7 @@ int random_op()
 
             if (max_elements_reached)
             {
-                const uint16_t buffer_set_size = buffer_set_get_size(buffer_set);
+                const buffer_set_size_t buffer_set_size = buffer_set_get_size(buffer_set);
                 if (buffer_set_size == 0)
                     break;
             }
@@ -335,12 +335,12 @@ int random_op()
         if (ret != 0)
             break;
 
-        const uint16_t buffer_set_size = buffer_set_get_size(buffer_set);
+        const buffer_set_size_t buffer_set_size = buffer_set_get_size(buffer_set);
         if (golden_set.size != buffer_set_size)
         {
             printf(
-                "buffer set size %hu not equal to the golden set size %zu",
-                buffer_set_size,
+                "buffer set size %u not equal to the golden set size %zu",
+                (unsigned int) buffer_set_size,
                 golden_set.size
             );
             history_print(&history);
@@ -0,0 +1,168 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define RANGE 3000
+
+static int _check(buffer_set_t * result, const char * name, const unsigned char * a, const unsigned char * b, int op)
+{
+    if (result == NULL)
+    {
+        printf("buffer_set_%s() failed", name);
+        return -1;
+    }
+
+    int rc = 0;
+    int size = 0;
+    for (int value=0; value<RANGE; value++)
+    {
+        const int expected = (op == 0) ? (a[value] || b[value])
+            : (op == 1) ? (a[value] && b[value])
+            : (a[value] && !b[value]);
+        size += expected;
+        if ((buffer_set_get(result, &value) != NULL) != expected)
+        {
+            fprintf(stderr, "%s: value %d is unexpectedly %s\n", name, value, expected ? "missing" : "present");
+            rc = -1;
+            break;
+        }
+    }
+
+    if ((rc == 0) && ((int) buffer_set_get_size(result) != size))
+    {
+        fprintf(stderr, "%s: unexpected size\n", name);
+        rc = -1;
+    }
+
+    if ((rc == 0) && (buffer_set_verify(result, stderr) != 0))
+        rc = -1;
+
+    // the result is a regular set
+    const int value = RANGE;
+    int inserted;
+    int * ptr = buffer_set_insert(result, &value, &inserted);
+    if ((rc == 0) && ((ptr == NULL) || !inserted))
+    {
+        fprintf(stderr, "%s: insert into the result failed\n", name);
+        rc = -1;
+    }
+
+    buffer_set_snapshot_t * snapshot = buffer_set_snapshot(result);
+    if ((rc == 0) && (snapshot == NULL))
+    {
+        fprintf(stderr, "%s: snapshot of the result failed\n", name);
+        rc = -1;
+    }
+    if (snapshot)
+        buffer_set_snapshot_release(snapshot);
+
+    buffer_set_destroy(result);
+    return rc;
+}
+
+static int _set_algebra(int count_a, int count_b)
+{
+    buffer_set_t * set_a = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    buffer_set_t * set_b = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    if ((set_a == NULL) || (set_b == NULL))
+    {
+        printf("buffer_set_create() failed");
+        return -1;
+    }
+
+    unsigned char a[RANGE];
+    unsigned char b[RANGE];
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    srand(count_a + count_b);
+    for (int idx=0; idx<count_a; idx++)
+    {
+        int inserted;
+        const int value = (rand() % RANGE);
+        int * ptr = buffer_set_insert(set_a, &value, &inserted);
+        *ptr = value;
+        a[value] = 1;
+    }
+    for (int idx=0; idx<count_b; idx++)
+    {
+        int inserted;
+        const int value = (rand() % RANGE);
+        int * ptr = buffer_set_insert(set_b, &value, &inserted);
+        *ptr = value;
+        b[value] = 1;
+    }
+
+    int rc = 0;
+    if (_check(buffer_set_union(set_a, set_b), "union", a, b, 0) != 0)
+        rc = -1;
+    else if (_check(buffer_set_intersect(set_a, set_b), "intersect", a, b, 1) != 0)
+        rc = -1;
+    else if (_check(buffer_set_difference(set_a, set_b), "difference", a, b, 2) != 0)
+        rc = -1;
+
+    // the result of an operation on a read only snapshot set is writable
+    buffer_set_snapshot_t * snapshot = buffer_set_snapshot(set_a);
+    if (snapshot == NULL)
+        rc = -1;
+    else
+    {
+        buffer_set_t * view = buffer_set_snapshot_get_set(snapshot);
+        if ((rc == 0) && (_check(buffer_set_union(view, set_b), "union", a, b, 0) != 0))
+            rc = -1;
+        if ((rc == 0) && (_check(buffer_set_intersect(view, set_b), "intersect", a, b, 1) != 0))
+            rc = -1;
+        if ((rc == 0) && (_check(buffer_set_difference(view, set_b), "difference", a, b, 2) != 0))
+            rc = -1;
+        buffer_set_snapshot_release(snapshot);
+    }
+
+    buffer_set_destroy(set_a);
+    buffer_set_destroy(set_b);
+    return rc;
+}
+
+static int _other_cmp(const void * v1, const void * v2, void * thunk)
+{
+    return -int_cmp(v1, v2, thunk);
+}
+
+int set_algebra()
+{
+    if (_set_algebra(0, 0) != 0)
+        return -1;
+    if (_set_algebra(100, 0) != 0)
+        return -1;
+    if (_set_algebra(0, 100) != 0)
+        return -1;
+    if (_set_algebra(2000, 1500) != 0)
+        return -1;
+
+    // sets ordered differently can not be merged
+    buffer_set_t * set_a = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    buffer_set_t * set_b = buffer_set_create(sizeof(int), 0, &_other_cmp, NULL, NULL);
+    int rc = 0;
+    if (buffer_set_union(set_a, set_b) != NULL)
+    {
+        fprintf(stderr, "incompatible sets are unexpectedly merged\n");
+        rc = -1;
+    }
+    buffer_set_destroy(set_a);
+    buffer_set_destroy(set_b);
+    return rc;
+}
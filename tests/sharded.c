@@ -0,0 +1,295 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+typedef HANDLE thread_t;
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+#endif
+
+#define WRITERS 4
+#define SHARDS 8
+// more values than one set with 16-bit indices can hold
+#define COUNT 100000
+
+struct value_s
+{
+    int key;
+    int check;
+};
+
+struct writer_s
+{
+    buffer_set_sharded_t * sharded;
+    int writer;
+    int erase;
+    int errors;
+};
+
+static int value_cmp(const void * v1, const void * v2, void * thunk)
+{
+    const int key1 = ((const struct value_s*) v1)->key;
+    const int key2 = ((const struct value_s*) v2)->key;
+    (void) thunk;
+    return (key1 > key2) - (key1 < key2);
+}
+
+static size_t value_hash(const void * value, void * thunk)
+{
+    (void) thunk;
+    return (size_t) ((const struct value_s*) value)->key;
+}
+
+static void _writer(struct writer_s * writer)
+{
+    for (int key=writer->writer; key<COUNT; key+=WRITERS)
+    {
+        struct value_s value;
+        value.key = key;
+        value.check = ((key * 3) + 1);
+        if (writer->erase)
+        {
+            // odd keys are erased, even ones are searched meanwhile
+            struct value_s found;
+            const int rc = (key & 1) ?
+                buffer_set_sharded_erase(writer->sharded, &value, &found) :
+                buffer_set_sharded_get(writer->sharded, &value, &found);
+            if ((rc != 1) || (found.check != value.check))
+                writer->errors++;
+        }
+        else if (buffer_set_sharded_insert(writer->sharded, &value) != 1)
+            writer->errors++;
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI _writer_thread(LPVOID arg)
+{
+    _writer(arg);
+    return 0;
+}
+#else
+static void * _writer_thread(void * arg)
+{
+    _writer(arg);
+    return NULL;
+}
+#endif
+
+static int _run_writers(buffer_set_sharded_t * sharded, int erase)
+{
+    struct writer_s writers[WRITERS];
+    thread_t threads[WRITERS];
+    for (int idx=0; idx<WRITERS; idx++)
+    {
+        writers[idx].sharded = sharded;
+        writers[idx].writer = idx;
+        writers[idx].erase = erase;
+        writers[idx].errors = 0;
+#if defined(_WIN32)
+        threads[idx] = CreateThread(NULL, 0, &_writer_thread, &writers[idx], 0, NULL);
+#else
+        pthread_create(&threads[idx], NULL, &_writer_thread, &writers[idx]);
+#endif
+    }
+
+    int rc = 0;
+    for (int idx=0; idx<WRITERS; idx++)
+    {
+#if defined(_WIN32)
+        WaitForSingleObject(threads[idx], INFINITE);
+        CloseHandle(threads[idx]);
+#else
+        pthread_join(threads[idx], NULL);
+#endif
+        if (writers[idx].errors)
+        {
+            fprintf(stderr, "writer %d got %d unexpected results\n", idx, writers[idx].errors);
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+// Walks the merged iterator expecting keys from first to last with the step.
+static int _check_order(buffer_set_sharded_t * sharded, int first, int last, int step)
+{
+    buffer_set_sharded_iterator_t * it = buffer_set_sharded_iterator_create(sharded);
+    if (it == NULL)
+    {
+        fprintf(stderr, "buffer_set_sharded_iterator_create() failed\n");
+        return -1;
+    }
+
+    int rc = 0;
+    int expected = first;
+    const struct value_s * value;
+    while ((value = buffer_set_sharded_iterator_next(it)) != NULL)
+    {
+        if ((value->key != expected) || (value->check != ((expected * 3) + 1)))
+        {
+            fprintf(stderr, "merged iterator: got %d, expected %d\n", value->key, expected);
+            rc = -1;
+            break;
+        }
+        expected += step;
+    }
+    if ((rc == 0) && (expected != (last + step)))
+    {
+        fprintf(stderr, "merged iterator stopped at %d, expected %d\n", expected, last + step);
+        rc = -1;
+    }
+    buffer_set_sharded_iterator_destroy(it);
+    return rc;
+}
+
+// Inserts into empty shards while an iterator holds their snapshots.
+static int _insert_into_empty_shards(const buffer_set_options_t * options)
+{
+    buffer_set_sharded_t * sharded = buffer_set_sharded_create(options, SHARDS, &value_hash);
+    if (sharded == NULL)
+    {
+        fprintf(stderr, "buffer_set_sharded_create() failed\n");
+        return -1;
+    }
+
+    int rc = 0;
+    buffer_set_sharded_iterator_t * it = buffer_set_sharded_iterator_create(sharded);
+    if (it == NULL)
+        rc = -1;
+
+    for (int key=0; (rc == 0) && (key<(SHARDS * 4)); key++)
+    {
+        struct value_s value;
+        value.key = key;
+        value.check = ((key * 3) + 1);
+        if (buffer_set_sharded_insert(sharded, &value) != 1)
+        {
+            fprintf(stderr, "buffer_set_sharded_insert() failed for %d\n", key);
+            rc = -1;
+        }
+    }
+
+    if (it)
+    {
+        if ((rc == 0) && (buffer_set_sharded_iterator_next(it) != NULL))
+        {
+            fprintf(stderr, "iterator of empty shards returned a value\n");
+            rc = -1;
+        }
+        buffer_set_sharded_iterator_destroy(it);
+    }
+
+    if (rc == 0)
+        rc = _check_order(sharded, 0, ((SHARDS * 4) - 1), 1);
+    buffer_set_sharded_destroy(sharded);
+    return rc;
+}
+
+int sharded()
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(struct value_s);
+    options.compar = &value_cmp;
+
+    if ((buffer_set_sharded_create(&options, SHARDS, NULL) != NULL) || (errno != EINVAL))
+    {
+        fprintf(stderr, "sharded set created without a hash function\n");
+        return -1;
+    }
+
+    buffer_set_sharded_t * sharded = buffer_set_sharded_create(&options, SHARDS, &value_hash);
+    if (sharded == NULL)
+    {
+        fprintf(stderr, "buffer_set_sharded_create() failed\n");
+        return -1;
+    }
+
+    int rc = _run_writers(sharded, 0);
+    if ((rc == 0) && (buffer_set_sharded_get_size(sharded) != COUNT))
+    {
+        fprintf(stderr, "unexpected size %zu\n", buffer_set_sharded_get_size(sharded));
+        rc = -1;
+    }
+
+    struct value_s value;
+    value.key = 0;
+    value.check = 0;
+    if ((rc == 0) && (buffer_set_sharded_insert(sharded, &value) != 0))
+    {
+        fprintf(stderr, "duplicate value inserted\n");
+        rc = -1;
+    }
+
+    if (rc == 0)
+        rc = _check_order(sharded, 0, (COUNT - 1), 1);
+
+    // the iterator keeps the content the shards had when it was created
+    buffer_set_sharded_iterator_t * it = NULL;
+    if (rc == 0)
+    {
+        it = buffer_set_sharded_iterator_create(sharded);
+        if (it == NULL)
+            rc = -1;
+    }
+
+    if (rc == 0)
+        rc = _run_writers(sharded, 1);
+
+    if (it)
+    {
+        for (int key=0; key<COUNT; key++)
+        {
+            const struct value_s * ptr = buffer_set_sharded_iterator_next(it);
+            if ((ptr == NULL) || (ptr->key != key))
+            {
+                fprintf(stderr, "iterator changed by the writers at %d\n", key);
+                rc = -1;
+                break;
+            }
+        }
+        buffer_set_sharded_iterator_destroy(it);
+    }
+
+    if (rc == 0)
+        rc = _check_order(sharded, 0, (COUNT - 2), 2);
+
+    for (int key=0; (rc == 0) && (key<COUNT); key++)
+    {
+        struct value_s found;
+        value.key = key;
+        const int found_rc = buffer_set_sharded_get(sharded, &value, &found);
+        if ((found_rc != !(key & 1)) || (found_rc && (found.check != ((key * 3) + 1))))
+        {
+            fprintf(stderr, "unexpected lookup result for %d\n", key);
+            rc = -1;
+        }
+    }
+
+    buffer_set_sharded_destroy(sharded);
+
+    if (rc == 0)
+        rc = _insert_into_empty_shards(&options);
+    return rc;
+}
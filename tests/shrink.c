@@ -18,31 +18,58 @@
 #include <string.h>
 #include "test.h"
 
-int shrink()
+static void value_move(void * dst, void * src, void * thunk)
 {
-    buffer_set_t* buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    memcpy(dst, src, sizeof(int));
+    *((int*)thunk) = 1;
+}
+
+static int _shrink(unsigned int flags, int use_move, int count, int keep)
+{
+    int move_called = 0;
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_cmp;
+    options.move = use_move ? &value_move : NULL;
+    options.thunk = &move_called;
+    options.flags = flags;
+
+    buffer_set_t* buffer_set = buffer_set_create_ex(&options);
     if (buffer_set == NULL)
     {
-        printf("buffer_set_create() failed");
+        printf("buffer_set_create_ex() failed");
         return -1;
     }
 
-    for (int idx=0; idx<63; idx++)
+    for (int idx=0; idx<count; idx++)
     {
         int inserted = 0;
         void * ptr = buffer_set_insert(buffer_set, &idx, &inserted);
         *((int*)ptr) = idx;
     }
 
-    for (int idx=0; idx<50; idx++)
+    // erase the values inserted first, remaining nodes are located
+    // at the end of the buffer and have to be moved down
+    for (int idx=0; idx<(count-keep); idx++)
         buffer_set_erase(buffer_set, &idx);
 
+    const buffer_set_size_t capacity = buffer_set_get_capacity(buffer_set);
     buffer_set_shrink(buffer_set);
 
     int rc = 0;
+    if (buffer_set_get_capacity(buffer_set) >= capacity)
+    {
+        fprintf(stderr, "capacity was not reduced\n");
+        rc = -1;
+    }
+
+    if (buffer_set_verify(buffer_set, stderr) != 0)
+        rc = -1;
+
     buffer_set_iterator_t * it = buffer_set_begin(buffer_set);
 
-    for (int idx=50; idx<63; idx++)
+    for (int idx=(count-keep); idx<count; idx++)
     {
         if (it == buffer_set_end(buffer_set))
         {
@@ -68,7 +95,42 @@ int shrink()
         rc = -1;
     }
 
+    if (move_called != use_move)
+    {
+        fprintf(stderr, "unexpected move function usage\n");
+        rc = -1;
+    }
+
+    // the set should still be usable after the shrink
+    for (int idx=0; idx<(count-keep); idx++)
+    {
+        int inserted = 0;
+        void * ptr = buffer_set_insert(buffer_set, &idx, &inserted);
+        *((int*)ptr) = idx;
+    }
+
+    if (((int) buffer_set_get_size(buffer_set) != count) || (buffer_set_verify(buffer_set, stderr) != 0))
+    {
+        fprintf(stderr, "set is broken after shrink\n");
+        rc = -1;
+    }
+
     buffer_set_destroy(buffer_set);
 
     return rc;
 }
+
+int shrink()
+{
+    if (_shrink(0, 0, 63, 13) != 0)
+        return -1;
+    if (_shrink(0, 0, 1000, 100) != 0)
+        return -1;
+    if (_shrink(BUFFER_SET_SPLIT_VALUES, 0, 1000, 100) != 0)
+        return -1;
+    if (_shrink(0, 1, 1000, 100) != 0)
+        return -1;
+    if (_shrink(BUFFER_SET_SPLIT_VALUES, 1, 1000, 100) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define COUNT 1000
+
+static size_t int_hash(const void * value, void * thunk)
+{
+    (void) thunk;
+    return ((size_t) *((const int*) value) * 2654435761u);
+}
+
+static void int_move(void * dst, void * src, void * thunk)
+{
+    (void) thunk;
+    memcpy(dst, src, sizeof(int));
+}
+
+static int _check(buffer_set_t * buffer_set, int first, int step, int count)
+{
+    // values first, first + step, ... count values
+    if ((int) buffer_set_get_size(buffer_set) != count)
+    {
+        fprintf(stderr, "unexpected size %d instead of %d\n", (int) buffer_set_get_size(buffer_set), count);
+        return -1;
+    }
+    int expected = first;
+    buffer_set_cursor_t cursor;
+    for (int * value=buffer_set_cursor_first(buffer_set, &cursor); value; value=buffer_set_cursor_next(buffer_set, &cursor))
+    {
+        if ((*value != expected) || (buffer_set_get(buffer_set, &expected) != value))
+        {
+            fprintf(stderr, "unexpected value %d instead of %d\n", *value, expected);
+            return -1;
+        }
+        expected += step;
+    }
+    return buffer_set_verify(buffer_set, stderr);
+}
+
+static int _insert(buffer_set_t * buffer_set, int value)
+{
+    int inserted;
+    int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+    if (ptr == NULL)
+        return -1;
+    *ptr = value;
+    return 0;
+}
+
+static int _snapshot(unsigned int flags, int with_hash)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_cmp;
+    options.flags = flags;
+    options.hash = with_hash ? &int_hash : NULL;
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    int rc = 0;
+    for (int value=0; value<(COUNT * 2); value+=2)
+        rc |= _insert(buffer_set, value);
+
+    // repeated snapshots of an unchanged set are the same
+    buffer_set_snapshot_t * snapshot = buffer_set_snapshot(buffer_set);
+    buffer_set_snapshot_t * same_snapshot = buffer_set_snapshot(buffer_set);
+    if ((snapshot == NULL) || (snapshot != same_snapshot))
+    {
+        fprintf(stderr, "unexpected snapshot\n");
+        buffer_set_destroy(buffer_set);
+        return -1;
+    }
+    buffer_set_snapshot_release(same_snapshot);
+    buffer_set_t * view = buffer_set_snapshot_get_set(snapshot);
+
+    // the set is modified in place, grows and is rebuilt,
+    // the snapshot keeps the original content
+    for (int value=1; value<(COUNT * 2); value+=2)
+        rc |= _insert(buffer_set, value);
+    if ((rc == 0) && (_check(view, 0, 2, COUNT) != 0))
+        rc = -1;
+    for (int value=0; value<(COUNT * 2); value+=2)
+        buffer_set_erase(buffer_set, &value);
+    if ((rc == 0) && ((_check(buffer_set, 1, 2, COUNT) != 0) || (_check(view, 0, 2, COUNT) != 0)))
+        rc = -1;
+
+    // a second snapshot of the modified set
+    buffer_set_snapshot_t * second = buffer_set_snapshot(buffer_set);
+    if (second == NULL)
+        rc = -1;
+    else
+    {
+        if (buffer_set_write_begin(buffer_set) != 0)
+            rc = -1;
+        // values modified in place inside a write section
+        int value = 1;
+        int * ptr = buffer_set_get(buffer_set, &value);
+        *ptr = 0;
+        buffer_set_write_end(buffer_set);
+        buffer_set_cursor_t cursor;
+        if ((rc == 0) && ((buffer_set_cursor_first(buffer_set, &cursor) != ptr) || (*ptr != 0) ||
+            (_check(buffer_set_snapshot_get_set(second), 1, 2, COUNT) != 0)))
+        {
+            fprintf(stderr, "value modified in place is shared with the snapshot\n");
+            rc = -1;
+        }
+        *ptr = 1;
+        buffer_set_snapshot_release(second);
+    }
+
+    // the set takes the buffer back if the snapshot is released
+    // before the next modification
+    second = buffer_set_snapshot(buffer_set);
+    buffer_set_snapshot_release(second);
+    rc |= _insert(buffer_set, -1);
+    if ((rc == 0) && ((buffer_set_get_size(buffer_set) != (COUNT + 1)) || (buffer_set_verify(buffer_set, stderr) != 0)))
+        rc = -1;
+
+    // the cleared and the destroyed set leave the buffer to the snapshot
+    second = buffer_set_snapshot(buffer_set);
+    const buffer_set_size_t capacity = buffer_set_get_capacity(buffer_set);
+    buffer_set_clear(buffer_set);
+    if ((rc == 0) && ((buffer_set_get_size(buffer_set) != 0) || (buffer_set_get_capacity(buffer_set) != capacity)))
+    {
+        fprintf(stderr, "the capacity is not kept by the clear\n");
+        rc = -1;
+    }
+    if ((rc == 0) && ((_insert(buffer_set, 5) != 0) || (_check(buffer_set, 5, 1, 1) != 0)))
+        rc = -1;
+    buffer_set_destroy(buffer_set);
+    if ((rc == 0) && (second != NULL) && (buffer_set_get_size(buffer_set_snapshot_get_set(second)) != (COUNT + 1)))
+        rc = -1;
+    buffer_set_snapshot_release(second);
+
+    if ((rc == 0) && (_check(view, 0, 2, COUNT) != 0))
+        rc = -1;
+    buffer_set_snapshot_release(snapshot);
+    return rc;
+}
+
+int snapshot()
+{
+    if (_snapshot(0, 0) != 0)
+        return -1;
+    if (_snapshot(BUFFER_SET_SPLIT_VALUES | BUFFER_SET_ORDER_STATISTICS, 1) != 0)
+        return -1;
+
+    // a snapshot of an empty set without a buffer is detached on the first growth
+    buffer_set_t * empty = buffer_set_create(sizeof(int), 0, &int_cmp, NULL, NULL);
+    buffer_set_snapshot_t * empty_snapshot = buffer_set_snapshot(empty);
+    int rc = ((empty_snapshot == NULL) || (_insert(empty, 1) != 0) || (_insert(empty, 2) != 0) ||
+        (buffer_set_get_size(buffer_set_snapshot_get_set(empty_snapshot)) != 0) ||
+        (_check(empty, 1, 1, 2) != 0)) ? -1 : 0;
+    buffer_set_snapshot_release(empty_snapshot);
+    buffer_set_destroy(empty);
+    if (rc != 0)
+        return -1;
+
+    // values relocated with a move function can not be copied bytewise
+    buffer_set_t * buffer_set = buffer_set_create(sizeof(int), 0, &int_cmp, &int_move, NULL);
+    buffer_set_snapshot_t * snapshot = buffer_set_snapshot(buffer_set);
+    buffer_set_destroy(buffer_set);
+    return ((snapshot == NULL) && (errno == EINVAL)) ? 0 : -1;
+}
@@ -0,0 +1,160 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+static size_t int_hash(const void * value, void * thunk)
+{
+    (void) thunk;
+    return ((size_t) *((const int*) value) * 2654435761u);
+}
+
+static void int_move(void * dst, void * src, void * thunk)
+{
+    // the source is poisoned to catch values used after the relocation
+    (void) thunk;
+    memcpy(dst, src, sizeof(int));
+    *((int*) src) = -1;
+}
+
+static buffer_set_t * _create(unsigned int flags, int with_hash, int use_move, int first, int count)
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(int);
+    options.compar = &int_cmp;
+    options.flags = flags;
+    options.hash = with_hash ? &int_hash : NULL;
+    options.move = use_move ? &int_move : NULL;
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if (buffer_set == NULL)
+        return NULL;
+
+    // every other value is erased to have a free list with holes
+    for (int idx=0; idx<(count * 2); idx++)
+    {
+        int inserted;
+        const int value = (first + idx);
+        int * ptr = buffer_set_insert(buffer_set, &value, &inserted);
+        if (ptr == NULL)
+        {
+            buffer_set_destroy(buffer_set);
+            return NULL;
+        }
+        *ptr = value;
+    }
+    for (int idx=1; idx<(count * 2); idx+=2)
+    {
+        const int value = (first + idx);
+        buffer_set_erase(buffer_set, &value);
+    }
+    return buffer_set;
+}
+
+static int _check(buffer_set_t * buffer_set, int first, int count)
+{
+    // values first, first + 2, ... count values
+    if ((int) buffer_set_get_size(buffer_set) != count)
+    {
+        fprintf(stderr, "unexpected size %d instead of %d\n", (int) buffer_set_get_size(buffer_set), count);
+        return -1;
+    }
+    int expected = first;
+    buffer_set_cursor_t cursor;
+    for (int * value=buffer_set_cursor_first(buffer_set, &cursor); value; value=buffer_set_cursor_next(buffer_set, &cursor))
+    {
+        if ((*value != expected) || (buffer_set_get(buffer_set, &expected) != value))
+        {
+            fprintf(stderr, "unexpected value %d instead of %d\n", *value, expected);
+            return -1;
+        }
+        expected += 2;
+    }
+    return buffer_set_verify(buffer_set, stderr);
+}
+
+static int _join(unsigned int flags, int with_hash, int use_move, int count_a, int count_b)
+{
+    buffer_set_t * a = _create(flags, with_hash, use_move, 0, count_a);
+    buffer_set_t * b = _create(flags, with_hash, use_move, count_a * 2, count_b);
+    if ((a == NULL) || (b == NULL))
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    int rc = 0;
+    if ((count_a > 0) && (count_b > 0) && (buffer_set_join(b, a) == 0))
+    {
+        fprintf(stderr, "sets with overlapping values are unexpectedly joined\n");
+        rc = -1;
+    }
+    else if (buffer_set_join(a, b) != 0)
+    {
+        fprintf(stderr, "buffer_set_join() failed\n");
+        rc = -1;
+    }
+    // values relocated with the move function are taken from b
+    else if ((_check(a, 0, count_a + count_b) != 0) || (_check(b, count_a * 2, use_move ? 0 : count_b) != 0))
+        rc = -1;
+
+    // split at every position of the joined set and join the parts back
+    const int total = (count_a + count_b);
+    for (int key=-1; (rc == 0) && (key<=(total * 2)); key+=((total > 100) ? 97 : 1))
+    {
+        buffer_set_t * hi;
+        if (buffer_set_split(a, &key, &hi) != 0)
+        {
+            fprintf(stderr, "buffer_set_split() failed\n");
+            rc = -1;
+            break;
+        }
+        const int lo_count = (key <= 0) ? 0 : (key >= (total * 2)) ? total : ((key + 1) / 2);
+        if ((_check(a, 0, lo_count) != 0) || (_check(hi, lo_count * 2, total - lo_count) != 0))
+            rc = -1;
+        else if ((buffer_set_join(a, hi) != 0) || (_check(a, 0, total) != 0))
+        {
+            fprintf(stderr, "split parts are not joined back\n");
+            rc = -1;
+        }
+        buffer_set_destroy(hi);
+    }
+
+    buffer_set_destroy(a);
+    buffer_set_destroy(b);
+    return rc;
+}
+
+int split_join()
+{
+    // trees of equal and of very different heights, empty ones
+    const int counts[][2] = { { 0, 0 }, { 0, 1 }, { 1, 0 }, { 0, 50 }, { 50, 0 }, { 1, 1 },
+        { 1000, 1 }, { 1, 1000 }, { 1000, 3 }, { 7, 1000 }, { 500, 600 }, { 3000, 40 } };
+    for (size_t idx=0; idx<(sizeof(counts) / sizeof(counts[0])); idx++)
+    {
+        if (_join(0, 0, 0, counts[idx][0], counts[idx][1]) != 0)
+            return -1;
+        if (_join(BUFFER_SET_ORDER_STATISTICS, 1, 0, counts[idx][0], counts[idx][1]) != 0)
+            return -1;
+        if (_join(BUFFER_SET_SPLIT_VALUES, 0, 0, counts[idx][0], counts[idx][1]) != 0)
+            return -1;
+        if (_join(BUFFER_SET_ORDER_STATISTICS, 1, 1, counts[idx][0], counts[idx][1]) != 0)
+            return -1;
+    }
+    return 0;
+}
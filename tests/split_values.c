@@ -0,0 +1,114 @@
+/*
+ * This file is part of BUFFER_SET library.
+ * Copyright (C) 2020 Sergey Zubarev, info@js-labs.org
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ */
+
+#include <buffer_set/buffer_set.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define COUNT 500
+
+struct record_s
+{
+    int key;
+    char payload[124];
+};
+
+static int record_cmp(const void * v1, const void * v2, void * thunk)
+{
+    return int_cmp(v1, v2, thunk);
+}
+
+int split_values()
+{
+    buffer_set_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.value_size = sizeof(struct record_s);
+    options.compar = &record_cmp;
+    options.flags = BUFFER_SET_SPLIT_VALUES;
+
+    buffer_set_t * buffer_set = buffer_set_create_ex(&options);
+    if (buffer_set == NULL)
+    {
+        printf("buffer_set_create_ex() failed");
+        return -1;
+    }
+
+    int ret = 0;
+
+    for (int idx=0; idx<COUNT; idx++)
+    {
+        struct record_s record;
+        record.key = ((idx * 7919) % COUNT);
+        int inserted;
+        struct record_s * ptr = buffer_set_insert(buffer_set, &record, &inserted);
+        if (!ptr)
+        {
+            printf("buffer_set_insert() unexpectedly returned NULL for %d", record.key);
+            ret = -1;
+            break;
+        }
+        ptr->key = record.key;
+        memset(ptr->payload, (char) record.key, sizeof(ptr->payload));
+    }
+
+    for (int idx=0; (ret == 0) && (idx<COUNT); idx+=3)
+    {
+        if (buffer_set_erase(buffer_set, &idx) == NULL)
+        {
+            printf("buffer_set_erase() failed for %d", idx);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0)
+        buffer_set_shrink(buffer_set);
+
+    if ((ret == 0) && (buffer_set_verify(buffer_set, stdout) != 0))
+        ret = -1;
+
+    if (ret == 0)
+    {
+        int expected = 1;
+        buffer_set_iterator_t * it = buffer_set_begin(buffer_set);
+        buffer_set_iterator_t * it_end = buffer_set_end(buffer_set);
+        for (; it != it_end; it = buffer_set_iterator_next(buffer_set, it))
+        {
+            const struct record_s * record = buffer_set_get_at(buffer_set, it);
+            if ((record->key != expected) || (record->payload[123] != (char) expected))
+            {
+                printf("got %d instead of %d", record->key, expected);
+                ret = -1;
+                break;
+            }
+            if (buffer_set_get(buffer_set, &expected) != record)
+            {
+                printf("buffer_set_get() returned unexpected pointer for %d", expected);
+                ret = -1;
+                break;
+            }
+            expected += ((expected % 3) == 1) ? 1 : 2;
+        }
+        if ((ret == 0) && (expected < COUNT))
+        {
+            printf("iteration stopped at %d", expected);
+            ret = -1;
+        }
+    }
+
+    buffer_set_destroy(buffer_set);
+
+    return ret;
+}